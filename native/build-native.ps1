@@ -13,7 +13,7 @@ $dll = Join-Path $bin "ios_device_bridge.dll"
 $obj = Join-Path $bin "ios_device_bridge.obj"
 
 Write-Host "Building native bridge ($Configuration)..."
-cl /nologo /std:c++17 /EHsc /LD /DWIN32 /D_WINDOWS /D_USRDLL /D_WINDLL $src /Fe:$dll /Fo:$obj
+cl /nologo /std:c++17 /EHsc /LD /DWIN32 /D_WINDOWS /D_USRDLL /D_WINDLL $src /Fe:$dll /Fo:$obj ole32.lib windowscodecs.lib mfplat.lib mfreadwrite.lib mfuuid.lib
 if ($LASTEXITCODE -ne 0) {
     throw "Native build failed with exit code $LASTEXITCODE."
 }
@@ -0,0 +1,53 @@
+param(
+    [switch]$Bench,
+    [int]$RttUs = 1000
+)
+
+$ErrorActionPreference = "Stop"
+
+$root = Split-Path -Parent $MyInvocation.MyCommand.Path
+$testsDir = Join-Path $root "tests"
+$bin = Join-Path $root "bin\tests"
+New-Item -ItemType Directory -Path $bin -Force | Out-Null
+
+# The fake runtime takes the real DLL name, so the bridge loads it from the
+# test executable's folder through its normal loader.
+$fakeDll = Join-Path $bin "libimobiledevice-1.0.dll"
+$fakeLib = Join-Path $bin "libimobiledevice-1.0.lib"
+$systemLibs = @("ole32.lib", "windowscodecs.lib", "mfplat.lib", "mfreadwrite.lib", "mfuuid.lib")
+
+Write-Host "Building fake libimobiledevice runtime..."
+cl /nologo /std:c++17 /EHsc /LD (Join-Path $testsDir "fake_afc.cpp") /Fe:$fakeDll /Fo:(Join-Path $bin "fake_afc.obj")
+if ($LASTEXITCODE -ne 0) {
+    throw "Fake runtime build failed with exit code $LASTEXITCODE."
+}
+
+$targets = @("bridge_tests")
+if ($Bench) {
+    $targets += "bridge_bench"
+}
+
+foreach ($target in $targets) {
+    Write-Host "Building $target..."
+    $exe = Join-Path $bin "$target.exe"
+    cl /nologo /std:c++17 /EHsc /O2 /DWIN32 /D_WINDOWS (Join-Path $testsDir "$target.cpp") /Fe:$exe /Fo:(Join-Path $bin "$target.obj") $fakeLib $systemLibs
+    if ($LASTEXITCODE -ne 0) {
+        throw "$target build failed with exit code $LASTEXITCODE."
+    }
+}
+
+Push-Location $bin
+try {
+    & (Join-Path $bin "bridge_tests.exe")
+    if ($LASTEXITCODE -ne 0) {
+        throw "Native tests failed."
+    }
+    if ($Bench) {
+        & (Join-Path $bin "bridge_bench.exe") $RttUs
+    }
+}
+finally {
+    Pop-Location
+}
+
+Write-Host "Done."
@@ -5,17 +5,34 @@
 #define NOMINMAX
 #endif
 #include <windows.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mfreadwrite.h>
+#include <wincodec.h>
+#include <wrl/client.h>
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cctype>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <memory_resource>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -37,6 +54,22 @@ constexpr const char* kAfcServiceName = "com.apple.afc";
 constexpr int64_t kAfcModeReadOnly = 1;
 constexpr int64_t kAfcModeWriteOnly = 3;
 constexpr uint32_t kChunkSize = 64 * 1024;
+constexpr uint64_t kSmallFileThreshold = 64 * 1024;
+constexpr size_t kBatchWriterCapacity = 4 * 1024 * 1024;
+constexpr int kRetryBaseDelayMs = 250;
+constexpr int kRetryMaxDelayMs = 4000;
+constexpr int64_t kRetryBudgetMs = 30000;
+constexpr int kAfcSeekSet = 0;
+constexpr int kIoClassCount = 3;
+constexpr int kPreviewTurnsPerBulkTurn = 4;
+constexpr int kDefaultThumbnailEdge = 256;
+constexpr int kMaxThumbnailEdge = 1024;
+constexpr uint64_t kJpegHeaderReadSize = 128 * 1024;
+constexpr uint64_t kPreviewFullReadLimit = 4 * 1024 * 1024;
+constexpr int kMaxMovieSampleReads = 8;
+constexpr int kDefaultAsyncWorkers = 4;
+constexpr int kMaxAsyncWorkers = 64;
+constexpr size_t kListingStatBatch = 16;
 constexpr const char* kLibIdeviceCandidates[] = {
     "libimobiledevice-1.0.dll",
     "imobiledevice.dll"
@@ -49,17 +82,205 @@ constexpr const char* kKnownRuntimeDeps[] = {
     "zlib1.dll"
 };
 
+struct BridgeMetrics {
+    std::atomic<uint64_t> afc_file_ops{0};
+    std::atomic<uint64_t> files_pulled{0};
+    std::atomic<uint64_t> small_file_pulls{0};
+    std::atomic<uint64_t> trailing_reads_skipped{0};
+    std::atomic<uint64_t> batched_local_flushes{0};
+    std::atomic<uint64_t> bytes_pulled{0};
+    std::atomic<uint64_t> list_calls{0};
+    std::atomic<uint64_t> list_entries{0};
+    std::atomic<uint64_t> list_heap_allocations{0};
+    std::atomic<uint64_t> afc_retries{0};
+    std::atomic<uint64_t> reconnects{0};
+    std::atomic<uint64_t> reconnect_failures{0};
+    std::atomic<uint64_t> operations_recovered{0};
+    std::atomic<uint64_t> retry_time_lost_ms{0};
+    std::atomic<uint64_t> io_interactive_turns{0};
+    std::atomic<uint64_t> io_interactive_wait_us{0};
+    std::atomic<uint64_t> io_preview_turns{0};
+    std::atomic<uint64_t> io_bulk_turns{0};
+    std::atomic<uint64_t> io_throttle_ms{0};
+    std::atomic<uint64_t> async_submitted{0};
+    std::atomic<uint64_t> async_completed{0};
+    std::atomic<uint64_t> thumb_requests{0};
+    std::atomic<uint64_t> thumb_cache_hits{0};
+    std::atomic<uint64_t> thumb_generated{0};
+    std::atomic<uint64_t> thumb_failures{0};
+    std::atomic<uint64_t> thumb_evictions{0};
+    std::atomic<uint64_t> thumb_bytes_read{0};
+    std::atomic<uint64_t> loader_load_us{0};
+    std::atomic<uint64_t> loader_probe_us{0};
+    std::atomic<uint64_t> first_connect_us{0};
+};
+
+BridgeMetrics g_metrics;
+
+void add_metric(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+    counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+// afc_error_t values the retry layer cares about.
+enum AfcError : int {
+    kAfcSuccess = 0,
+    kAfcUnknownError = 1,
+    kAfcOpHeaderInvalid = 2,
+    kAfcReadError = 4,
+    kAfcWriteError = 5,
+    kAfcServiceNotConnected = 11,
+    kAfcOpTimeout = 12,
+    kAfcOpWouldBlock = 19,
+    kAfcIoError = 20,
+    kAfcOpInterrupted = 21,
+    kAfcMuxError = 30,
+    kAfcNotEnoughData = 32
+};
+
 thread_local std::string g_last_error;
+thread_local int g_last_afc_rc = kAfcSuccess;
 std::mutex g_mutex;
 int g_next_handle = 1;
 
-struct DeviceSession {
+// Per-device I/O scheduler. Every AFC request runs inside a turn. Waiting
+// interactive work (listing, stat) always gets the next turn; thumbnail
+// previews come next, then bulk transfers, which take one turn per chunk so
+// browsing can slot in between reads. While a transfer waits, previews get at
+// most kPreviewTurnsPerBulkTurn turns in a row, so a grid of thumbnails slows
+// a pull down without stalling it. Only bulk transfers can be capped to a
+// byte rate.
+class IoScheduler {
+public:
+    template <typename F>
+    auto run(int io_class, F&& f) {
+        Turn turn(*this, io_class);
+        return f();
+    }
+
+    // Paces `bytes` of bulk transfer against the bandwidth cap. Called
+    // outside a turn so a throttled transfer does not block the device.
+    void throttle(uint64_t bytes) {
+        std::chrono::steady_clock::time_point wake;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Bucket& bucket = bulk_bucket_;
+            if (bucket.bytes_per_second == 0) {
+                return;
+            }
+            const auto now = std::chrono::steady_clock::now();
+            if (bucket.next_free < now) {
+                bucket.next_free = now;
+            }
+            bucket.next_free += std::chrono::microseconds(bytes * 1000000ull / bucket.bytes_per_second);
+            wake = bucket.next_free;
+        }
+        const auto delay = wake - std::chrono::steady_clock::now();
+        if (delay > std::chrono::steady_clock::duration::zero()) {
+            add_metric(g_metrics.io_throttle_ms, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(delay).count()));
+            std::this_thread::sleep_until(wake);
+        }
+    }
+
+    void set_bulk_bandwidth_limit(uint64_t bytes_per_second) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bulk_bucket_.bytes_per_second = bytes_per_second;
+    }
+
+private:
+    class Turn {
+    public:
+        Turn(IoScheduler& owner, int io_class) : owner_(owner) {
+            owner_.acquire(io_class);
+        }
+
+        ~Turn() {
+            owner_.release();
+        }
+
+        Turn(const Turn&) = delete;
+        Turn& operator=(const Turn&) = delete;
+
+    private:
+        IoScheduler& owner_;
+    };
+
+    struct Bucket {
+        uint64_t bytes_per_second = 0;
+        std::chrono::steady_clock::time_point next_free;
+    };
+
+    void acquire(int io_class) {
+        const auto started = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++waiting_[io_class];
+        ready_.wait(lock, [&] { return !busy_ && may_take_turn(io_class); });
+        --waiting_[io_class];
+        busy_ = true;
+        if (io_class == IOSB_IO_PREVIEW) {
+            preview_streak_ = waiting_[IOSB_IO_BULK] > 0 ? preview_streak_ + 1 : 0;
+        } else if (io_class == IOSB_IO_BULK) {
+            preview_streak_ = 0;
+        }
+        lock.unlock();
+
+        if (io_class == IOSB_IO_INTERACTIVE) {
+            const auto waited = std::chrono::steady_clock::now() - started;
+            add_metric(g_metrics.io_interactive_turns);
+            add_metric(g_metrics.io_interactive_wait_us, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(waited).count()));
+        } else if (io_class == IOSB_IO_PREVIEW) {
+            add_metric(g_metrics.io_preview_turns);
+        } else {
+            add_metric(g_metrics.io_bulk_turns);
+        }
+    }
+
+    // Called with mutex_ held and the device idle.
+    bool may_take_turn(int io_class) const {
+        if (io_class == IOSB_IO_INTERACTIVE) {
+            return true;
+        }
+        if (waiting_[IOSB_IO_INTERACTIVE] > 0) {
+            return false;
+        }
+        const bool bulk_is_due = preview_streak_ >= kPreviewTurnsPerBulkTurn;
+        if (io_class == IOSB_IO_PREVIEW) {
+            return waiting_[IOSB_IO_BULK] == 0 || !bulk_is_due;
+        }
+        return waiting_[IOSB_IO_PREVIEW] == 0 || bulk_is_due;
+    }
+
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            busy_ = false;
+        }
+        ready_.notify_all();
+    }
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    bool busy_ = false;
+    int waiting_[kIoClassCount] = {};
+    int preview_streak_ = 0;
+    Bucket bulk_bucket_;
+};
+
+// An open device. `lock` is held shared for each AFC request (one scheduler
+// turn) and exclusively while the AFC client is torn down or re-established;
+// each reconnect bumps `generation` so concurrent failures reconnect only
+// once. `closed` is set before close takes the lock, so transfers stop at
+// their next chunk instead of holding close up until they finish.
+struct DeviceSession : std::enable_shared_from_this<DeviceSession> {
     std::string udid;
     idevice_t device = nullptr;
     afc_client_t afc = nullptr;
+    std::shared_mutex lock;
+    uint64_t generation = 0;
+    std::atomic<bool> closed{false};
+    IoScheduler io;
 };
 
-std::unordered_map<int, DeviceSession> g_open_handles;
+std::unordered_map<int, std::shared_ptr<DeviceSession>> g_open_handles;
 
 int64_t now_unix() {
     using namespace std::chrono;
@@ -74,6 +295,12 @@ void set_error(const char* message) {
     g_last_error = (message != nullptr && message[0] != '\0') ? message : "Unknown error";
 }
 
+bool afc_failure(int rc, const char* message) {
+    g_last_afc_rc = rc;
+    set_error(std::string(message) + " (AFC error " + std::to_string(rc) + ")");
+    return false;
+}
+
 bool copy_text(char* target, int target_size, const std::string& src) {
     if (target == nullptr || target_size <= 0) {
         return false;
@@ -126,53 +353,52 @@ void append_line(std::string& s, const std::string& line) {
     s.push_back('\n');
 }
 
-std::string build_runtime_diagnostics() {
-    std::string out;
-    append_line(out, "libimobiledevice runtime diagnostics:");
-
-    bool found_candidate = false;
-    for (const char* candidate : kLibIdeviceCandidates) {
-        std::string full_path;
-        if (find_dll_on_search_path(candidate, &full_path)) {
-            found_candidate = true;
-            append_line(out, std::string("  FOUND  ") + candidate + " -> " + full_path);
-        } else {
-            append_line(out, std::string("  MISSING ") + candidate);
-        }
-    }
-
-    for (const char* dep : kKnownRuntimeDeps) {
-        std::string full_path;
-        if (find_dll_on_search_path(dep, &full_path)) {
-            append_line(out, std::string("  FOUND  ") + dep + " -> " + full_path);
-        } else {
-            append_line(out, std::string("  MISSING ") + dep);
-        }
-    }
-
-    HMODULE m = nullptr;
-    bool loaded_ok = false;
-    DWORD last_err = 0;
-    for (const char* candidate : kLibIdeviceCandidates) {
-        SetLastError(0);
-        m = LoadLibraryA(candidate);
-        last_err = GetLastError();
-        if (m != nullptr) {
-            append_line(out, std::string("  LOAD OK ") + candidate);
-            loaded_ok = true;
-            FreeLibrary(m);
-            break;
-        }
-    }
-
-    if (!loaded_ok) {
-        append_line(out, std::string("  LOAD FAILED: ") + win32_error_message(last_err) + " (code " + std::to_string(last_err) + ")");
-    }
+void append_metric(std::string& s, const char* key, uint64_t value) {
+    append_line(s, std::string(key) + "=" + std::to_string(static_cast<unsigned long long>(value)));
+}
 
-    if (!found_candidate) {
-        append_line(out, "Hint: copy runtime DLLs next to ios_device_bridge.dll or add their folder to PATH.");
-    }
+uint64_t elapsed_us(std::chrono::steady_clock::time_point since) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - since).count());
+}
 
+std::string build_metrics_report() {
+    std::string out;
+    append_metric(out, "loader_load_us", g_metrics.loader_load_us.load());
+    append_metric(out, "loader_probe_us", g_metrics.loader_probe_us.load());
+    append_metric(out, "first_connect_us", g_metrics.first_connect_us.load());
+    append_metric(out, "afc_file_ops", g_metrics.afc_file_ops.load());
+    append_metric(out, "files_pulled", g_metrics.files_pulled.load());
+    append_metric(out, "small_file_pulls", g_metrics.small_file_pulls.load());
+    append_metric(out, "trailing_reads_skipped", g_metrics.trailing_reads_skipped.load());
+    append_metric(out, "batched_local_flushes", g_metrics.batched_local_flushes.load());
+    append_metric(out, "bytes_pulled", g_metrics.bytes_pulled.load());
+    append_metric(out, "list_calls", g_metrics.list_calls.load());
+    append_metric(out, "list_entries", g_metrics.list_entries.load());
+    append_metric(out, "list_heap_allocations", g_metrics.list_heap_allocations.load());
+    const uint64_t listed = g_metrics.list_entries.load();
+    if (listed > 0) {
+        char per_entry[32] = {};
+        std::snprintf(per_entry, sizeof(per_entry), "%.4f", static_cast<double>(g_metrics.list_heap_allocations.load()) / static_cast<double>(listed));
+        append_line(out, std::string("list_heap_allocations_per_entry=") + per_entry);
+    }
+    append_metric(out, "afc_retries", g_metrics.afc_retries.load());
+    append_metric(out, "reconnects", g_metrics.reconnects.load());
+    append_metric(out, "reconnect_failures", g_metrics.reconnect_failures.load());
+    append_metric(out, "operations_recovered", g_metrics.operations_recovered.load());
+    append_metric(out, "retry_time_lost_ms", g_metrics.retry_time_lost_ms.load());
+    append_metric(out, "io_interactive_turns", g_metrics.io_interactive_turns.load());
+    append_metric(out, "io_interactive_wait_us", g_metrics.io_interactive_wait_us.load());
+    append_metric(out, "io_preview_turns", g_metrics.io_preview_turns.load());
+    append_metric(out, "io_bulk_turns", g_metrics.io_bulk_turns.load());
+    append_metric(out, "io_throttle_ms", g_metrics.io_throttle_ms.load());
+    append_metric(out, "async_submitted", g_metrics.async_submitted.load());
+    append_metric(out, "async_completed", g_metrics.async_completed.load());
+    append_metric(out, "thumb_requests", g_metrics.thumb_requests.load());
+    append_metric(out, "thumb_cache_hits", g_metrics.thumb_cache_hits.load());
+    append_metric(out, "thumb_generated", g_metrics.thumb_generated.load());
+    append_metric(out, "thumb_failures", g_metrics.thumb_failures.load());
+    append_metric(out, "thumb_evictions", g_metrics.thumb_evictions.load());
+    append_metric(out, "thumb_bytes_read", g_metrics.thumb_bytes_read.load());
     return out;
 }
 
@@ -193,14 +419,21 @@ std::string hint_for_idevice_rc(int rc) {
     }
 }
 
-std::string join_path(const std::string& base, const std::string& name) {
-    if (base.empty() || base == "/") {
-        return std::string("/") + name;
+bool copy_joined(char* target, int target_size, std::string_view prefix, std::string_view name) {
+    if (target == nullptr || target_size <= 0) {
+        return false;
     }
-    if (base.back() == '/') {
-        return base + name;
+    const size_t limit = static_cast<size_t>(target_size - 1);
+    const size_t head = (std::min)(prefix.size(), limit);
+    const size_t tail = (std::min)(name.size(), limit - head);
+    if (head > 0) {
+        std::memcpy(target, prefix.data(), head);
     }
-    return base + "/" + name;
+    if (tail > 0) {
+        std::memcpy(target + head, name.data(), tail);
+    }
+    target[head + tail] = '\0';
+    return head + tail == prefix.size() + name.size();
 }
 
 std::string normalize_path(const char* path) {
@@ -268,13 +501,18 @@ bool dict_is_directory(char** dict) {
 }
 
 struct Entry {
-    std::string path;
-    std::string name;
+    std::string_view name;
     bool is_directory = false;
     uint64_t size_bytes = 0;
     int64_t modified_unix = 0;
 };
 
+// Loads libimobiledevice on first use. Once the runtime is loaded the
+// function pointers never change and ensure_loaded() is a single atomic
+// read; a failed load is retried on the next call, so runtime DLLs copied in
+// while the app runs are picked up. The PATH probe behind the diagnostics
+// report only runs when a report is requested or a load fails, and is cached
+// once the runtime is loaded.
 class LibIdeviceApi {
 public:
     using fn_idevice_get_device_list = int (*)(char***, int*);
@@ -284,7 +522,6 @@ public:
 
     using fn_lockdownd_client_new_with_handshake = int (*)(idevice_t, lockdownd_client_t*, const char*);
     using fn_lockdownd_client_free = int (*)(lockdownd_client_t);
-    using fn_lockdownd_get_device_name = int (*)(lockdownd_client_t, char**);
     using fn_lockdownd_start_service = int (*)(lockdownd_client_t, const char*, lockdownd_service_descriptor_t*);
     using fn_lockdownd_service_descriptor_free = int (*)(lockdownd_service_descriptor_t);
 
@@ -297,32 +534,67 @@ public:
     using fn_afc_file_close = int (*)(afc_client_t, uint64_t);
     using fn_afc_file_read = int (*)(afc_client_t, uint64_t, char*, uint32_t, uint32_t*);
     using fn_afc_file_write = int (*)(afc_client_t, uint64_t, const char*, uint32_t, uint32_t*);
+    using fn_afc_file_seek = int (*)(afc_client_t, uint64_t, int64_t, int);
 
     bool ensure_loaded() {
-        if (loaded_) {
+        if (loaded_.load(std::memory_order_acquire)) {
             return true;
         }
-
-        for (const char* dll_name : kLibIdeviceCandidates) {
-            module_ = LoadLibraryA(dll_name);
-            if (module_ != nullptr) {
-                break;
-            }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!loaded_.load(std::memory_order_relaxed)) {
+            load();
         }
-
-        if (module_ == nullptr) {
-            set_error(build_runtime_diagnostics());
+        if (!loaded_.load(std::memory_order_relaxed)) {
+            set_error(load_error_);
             return false;
         }
+        return true;
+    }
 
-        if (!load_all_symbols()) {
-            FreeLibrary(module_);
-            module_ = nullptr;
-            return false;
+    bool loaded() const {
+        return loaded_.load(std::memory_order_acquire);
+    }
+
+    // Reports on the runtime without loading it for the process: before the
+    // first successful load, the runtime is loaded, checked and freed again.
+    std::string diagnostics() {
+        std::string out;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (loaded_.load(std::memory_order_relaxed)) {
+                if (probe_report_.empty()) {
+                    probe_report_ = probe(current_);
+                }
+                out = probe_report_;
+            } else {
+                LoadAttempt trial;
+                if (const HMODULE module = open_runtime(trial)) {
+                    // Binds into the members, which nothing reads until
+                    // loaded_ is set by a real load.
+                    load_all_symbols(module, &trial.error);
+                    FreeLibrary(module);
+                    trial.ok = trial.error.empty();
+                }
+                out = probe(trial);
+            }
         }
 
-        loaded_ = true;
-        return true;
+        char timing[160] = {};
+        const uint64_t connect_us = g_metrics.first_connect_us.load();
+        std::snprintf(
+            timing,
+            sizeof(timing),
+            "Startup: runtime load %.1f ms, runtime probe %.1f ms",
+            g_metrics.loader_load_us.load() / 1000.0,
+            g_metrics.loader_probe_us.load() / 1000.0);
+        append_line(out, timing);
+        if (connect_us > 0) {
+            std::snprintf(timing, sizeof(timing), "First connect: %.1f ms", connect_us / 1000.0);
+        } else {
+            std::snprintf(timing, sizeof(timing), "First connect: not yet");
+        }
+        append_line(out, timing);
+        return out;
     }
 
     fn_idevice_get_device_list idevice_get_device_list = nullptr;
@@ -332,7 +604,6 @@ public:
 
     fn_lockdownd_client_new_with_handshake lockdownd_client_new_with_handshake = nullptr;
     fn_lockdownd_client_free lockdownd_client_free = nullptr;
-    fn_lockdownd_get_device_name lockdownd_get_device_name = nullptr;
     fn_lockdownd_start_service lockdownd_start_service = nullptr;
     fn_lockdownd_service_descriptor_free lockdownd_service_descriptor_free = nullptr;
 
@@ -345,41 +616,139 @@ public:
     fn_afc_file_close afc_file_close = nullptr;
     fn_afc_file_read afc_file_read = nullptr;
     fn_afc_file_write afc_file_write = nullptr;
+    fn_afc_file_seek afc_file_seek = nullptr;
 
 private:
+    // Outcome of opening the runtime; `name` is set once LoadLibraryA
+    // accepted a candidate, `error` when symbol binding then rejected it.
+    struct LoadAttempt {
+        bool ok = false;
+        std::string name;
+        std::string path;
+        std::string error;
+        DWORD error_code = 0;
+    };
+
+    static HMODULE open_runtime(LoadAttempt& attempt) {
+        for (const char* dll_name : kLibIdeviceCandidates) {
+            SetLastError(0);
+            const HMODULE module = LoadLibraryA(dll_name);
+            attempt.error_code = GetLastError();
+            if (module != nullptr) {
+                attempt.name = dll_name;
+                char path[MAX_PATH] = {};
+                const DWORD n = GetModuleFileNameA(module, path, MAX_PATH);
+                if (n > 0 && n < MAX_PATH) {
+                    attempt.path = path;
+                }
+                return module;
+            }
+        }
+        return nullptr;
+    }
+
+    // Called with mutex_ held.
+    void load() {
+        const auto started = std::chrono::steady_clock::now();
+        LoadAttempt attempt;
+        const HMODULE module = open_runtime(attempt);
+        if (module != nullptr && !load_all_symbols(module, &attempt.error)) {
+            FreeLibrary(module);
+        } else if (module != nullptr) {
+            attempt.ok = true;
+        }
+        g_metrics.loader_load_us.store(elapsed_us(started));
+
+        if (!attempt.ok) {
+            load_error_ = module == nullptr ? probe(attempt) : attempt.error;
+            return;
+        }
+        module_ = module;
+        current_ = attempt;
+        loaded_.store(true, std::memory_order_release);
+    }
+
+    // Scans the DLL search path for the runtime and its dependencies.
+    static std::string probe(const LoadAttempt& attempt) {
+        const auto started = std::chrono::steady_clock::now();
+        std::string out;
+        append_line(out, "libimobiledevice runtime diagnostics:");
+
+        bool found_candidate = false;
+        for (const char* candidate : kLibIdeviceCandidates) {
+            std::string full_path;
+            if (find_dll_on_search_path(candidate, &full_path)) {
+                found_candidate = true;
+                append_line(out, std::string("  FOUND  ") + candidate + " -> " + full_path);
+            } else {
+                append_line(out, std::string("  MISSING ") + candidate);
+            }
+        }
+
+        for (const char* dep : kKnownRuntimeDeps) {
+            std::string full_path;
+            if (find_dll_on_search_path(dep, &full_path)) {
+                append_line(out, std::string("  FOUND  ") + dep + " -> " + full_path);
+            } else {
+                append_line(out, std::string("  MISSING ") + dep);
+            }
+        }
+
+        const std::string loaded = attempt.name + (attempt.path.empty() ? "" : " -> " + attempt.path);
+        if (attempt.ok) {
+            append_line(out, "  LOAD OK " + loaded);
+        } else if (!attempt.name.empty()) {
+            // The DLL loaded but was rejected (and freed) during symbol binding.
+            append_line(out, "  LOAD FAILED " + loaded + ": " + attempt.error);
+        } else {
+            append_line(out, std::string("  LOAD FAILED: ") + win32_error_message(attempt.error_code) + " (code " + std::to_string(attempt.error_code) + ")");
+        }
+
+        if (!found_candidate) {
+            append_line(out, "Hint: copy runtime DLLs next to ios_device_bridge.dll or add their folder to PATH.");
+        }
+
+        g_metrics.loader_probe_us.store(elapsed_us(started));
+        return out;
+    }
+
     template <typename T>
-    bool load_symbol(T& fn, const char* symbol) {
-        fn = reinterpret_cast<T>(GetProcAddress(module_, symbol));
+    static bool load_symbol(HMODULE module, T& fn, const char* symbol, std::string* error) {
+        fn = reinterpret_cast<T>(GetProcAddress(module, symbol));
         if (fn == nullptr) {
-            set_error(std::string("Missing symbol in libimobiledevice runtime: ") + symbol);
+            *error = std::string("Missing symbol in libimobiledevice runtime: ") + symbol;
             return false;
         }
         return true;
     }
 
-    bool load_all_symbols() {
-        return load_symbol(idevice_get_device_list, "idevice_get_device_list") &&
-               load_symbol(idevice_device_list_free, "idevice_device_list_free") &&
-               load_symbol(idevice_new, "idevice_new") &&
-               load_symbol(idevice_free, "idevice_free") &&
-               load_symbol(lockdownd_client_new_with_handshake, "lockdownd_client_new_with_handshake") &&
-               load_symbol(lockdownd_client_free, "lockdownd_client_free") &&
-               load_symbol(lockdownd_get_device_name, "lockdownd_get_device_name") &&
-               load_symbol(lockdownd_start_service, "lockdownd_start_service") &&
-               load_symbol(lockdownd_service_descriptor_free, "lockdownd_service_descriptor_free") &&
-               load_symbol(afc_client_new, "afc_client_new") &&
-               load_symbol(afc_client_free, "afc_client_free") &&
-               load_symbol(afc_read_directory, "afc_read_directory") &&
-               load_symbol(afc_dictionary_free, "afc_dictionary_free") &&
-               load_symbol(afc_get_file_info, "afc_get_file_info") &&
-               load_symbol(afc_file_open, "afc_file_open") &&
-               load_symbol(afc_file_close, "afc_file_close") &&
-               load_symbol(afc_file_read, "afc_file_read") &&
-               load_symbol(afc_file_write, "afc_file_write");
-    }
-
+    bool load_all_symbols(HMODULE module, std::string* error) {
+        return load_symbol(module, idevice_get_device_list, "idevice_get_device_list", error) &&
+               load_symbol(module, idevice_device_list_free, "idevice_device_list_free", error) &&
+               load_symbol(module, idevice_new, "idevice_new", error) &&
+               load_symbol(module, idevice_free, "idevice_free", error) &&
+               load_symbol(module, lockdownd_client_new_with_handshake, "lockdownd_client_new_with_handshake", error) &&
+               load_symbol(module, lockdownd_client_free, "lockdownd_client_free", error) &&
+               load_symbol(module, lockdownd_start_service, "lockdownd_start_service", error) &&
+               load_symbol(module, lockdownd_service_descriptor_free, "lockdownd_service_descriptor_free", error) &&
+               load_symbol(module, afc_client_new, "afc_client_new", error) &&
+               load_symbol(module, afc_client_free, "afc_client_free", error) &&
+               load_symbol(module, afc_read_directory, "afc_read_directory", error) &&
+               load_symbol(module, afc_dictionary_free, "afc_dictionary_free", error) &&
+               load_symbol(module, afc_get_file_info, "afc_get_file_info", error) &&
+               load_symbol(module, afc_file_open, "afc_file_open", error) &&
+               load_symbol(module, afc_file_close, "afc_file_close", error) &&
+               load_symbol(module, afc_file_read, "afc_file_read", error) &&
+               load_symbol(module, afc_file_write, "afc_file_write", error) &&
+               load_symbol(module, afc_file_seek, "afc_file_seek", error);
+    }
+
+    std::mutex mutex_;
+    std::atomic<bool> loaded_{false};
     HMODULE module_ = nullptr;
-    bool loaded_ = false;
+    LoadAttempt current_;
+    std::string load_error_;
+    std::string probe_report_;
 };
 
 LibIdeviceApi& api() {
@@ -400,6 +769,7 @@ void close_session(DeviceSession& session) {
 }
 
 bool create_afc_session(const char* udid, DeviceSession& out) {
+    const auto started = std::chrono::steady_clock::now();
     auto& a = api();
     if (!a.ensure_loaded()) {
         return false;
@@ -441,55 +811,369 @@ bool create_afc_session(const char* udid, DeviceSession& out) {
     out.udid = udid != nullptr ? udid : "";
     out.device = device;
     out.afc = afc;
+
+    uint64_t unset = 0;
+    g_metrics.first_connect_us.compare_exchange_strong(unset, (std::max)(elapsed_us(started), uint64_t{1}));
+    return true;
+}
+
+// Errors that mean the link to the device dropped or stalled: a dead service
+// connection, a timeout, an interrupted or would-block request, an I/O or mux
+// failure, or a short read off the socket. A fresh AFC connection can fix
+// those. Anything else, including protocol and read/write errors reported by
+// the device itself, is reported as-is.
+bool is_transient_afc_error(int rc) {
+    switch (rc) {
+        case kAfcServiceNotConnected:
+        case kAfcOpTimeout:
+        case kAfcOpWouldBlock:
+        case kAfcIoError:
+        case kAfcOpInterrupted:
+        case kAfcMuxError:
+        case kAfcNotEnoughData:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Backoff before retry number `attempt` (from 0), capped at
+// kRetryMaxDelayMs, or -1 once waiting would take the operation past
+// kRetryBudgetMs since its first failure.
+int retry_delay_ms(int attempt, int64_t elapsed_ms) {
+    const int delay = (std::min)(kRetryBaseDelayMs << (std::min)(attempt, 8), kRetryMaxDelayMs);
+    return elapsed_ms + delay > kRetryBudgetMs ? -1 : delay;
+}
+
+// Replaces the session's AFC client unless another thread already did so
+// since `seen_generation`.
+bool reconnect_session(DeviceSession& session, uint64_t seen_generation) {
+    std::unique_lock<std::shared_mutex> lock(session.lock);
+    if (session.closed) {
+        set_error("Device handle was closed");
+        return false;
+    }
+    if (session.generation != seen_generation && session.afc != nullptr) {
+        return true;
+    }
+
+    close_session(session);
+    DeviceSession fresh;
+    if (!create_afc_session(session.udid.c_str(), fresh)) {
+        add_metric(g_metrics.reconnect_failures);
+        return false;
+    }
+    session.device = fresh.device;
+    session.afc = fresh.afc;
+    ++session.generation;
+    add_metric(g_metrics.reconnects);
     return true;
 }
 
+// One attempt's view of a session. Each AFC request runs in its own
+// scheduler turn under the session's shared lock, and fails with
+// AFC_E_NOT_CONNECTED instead of touching the client if the session was
+// closed or reconnected since the attempt started.
+class SessionIo {
+public:
+    SessionIo(DeviceSession& session, uint64_t generation) : session_(session), generation_(generation) {}
+
+    uint64_t generation() const {
+        return generation_;
+    }
+
+    // `f` issues AFC requests and returns an AFC error code.
+    template <typename F>
+    int run(int io_class, F&& f) {
+        return session_.io.run(io_class, [&]() -> int {
+            std::shared_lock<std::shared_mutex> lock(session_.lock);
+            if (session_.closed || session_.generation != generation_) {
+                afc_failure(kAfcServiceNotConnected, "Device connection was reset.");
+                return kAfcServiceNotConnected;
+            }
+            return f();
+        });
+    }
+
+    void throttle(uint64_t bytes) {
+        session_.io.throttle(bytes);
+    }
+
+private:
+    DeviceSession& session_;
+    uint64_t generation_;
+};
+
+// Runs an idempotent AFC operation, re-establishing the AFC client with
+// capped exponential backoff when it fails with a transient error, for up to
+// kRetryBudgetMs after the first failure. `op` receives
+// the client and a SessionIo for this attempt, and must be safe to replay
+// from its own saved state. Closing the session stops it at the next request.
+template <typename Op>
+bool run_with_retry(DeviceSession& session, Op&& op) {
+    std::chrono::steady_clock::time_point first_failure;
+    for (int attempt = 0;; ++attempt) {
+        uint64_t generation = 0;
+        afc_client_t afc = nullptr;
+        {
+            std::shared_lock<std::shared_mutex> lock(session.lock);
+            generation = session.generation;
+            afc = session.afc;
+        }
+        if (session.closed) {
+            set_error("Device handle was closed");
+            return false;
+        }
+
+        g_last_afc_rc = kAfcSuccess;
+        bool ok = false;
+        if (afc == nullptr) {
+            afc_failure(kAfcServiceNotConnected, "Device connection is not available.");
+        } else {
+            SessionIo io(session, generation);
+            ok = op(afc, io);
+        }
+        if (!ok && session.closed) {
+            set_error("Device handle was closed");
+            return false;
+        }
+
+        if (!ok && attempt == 0) {
+            first_failure = std::chrono::steady_clock::now();
+        }
+        const int delay_ms = ok || !is_transient_afc_error(g_last_afc_rc)
+            ? -1
+            : retry_delay_ms(attempt, static_cast<int64_t>(elapsed_us(first_failure) / 1000));
+        if (delay_ms < 0) {
+            if (attempt > 0) {
+                const auto lost = std::chrono::steady_clock::now() - first_failure;
+                add_metric(g_metrics.retry_time_lost_ms, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(lost).count()));
+                if (ok) {
+                    add_metric(g_metrics.operations_recovered);
+                }
+            }
+            return ok;
+        }
+
+        add_metric(g_metrics.afc_retries);
+        const std::string failure = g_last_error;
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+        if (!reconnect_session(session, generation)) {
+            set_error(failure + " Reconnect failed: " + g_last_error);
+        }
+    }
+}
+
 std::string resolve_device_name(const char* udid) {
     // Avoid lockdownd_get_device_name allocation/free ownership issues on Windows.
     // Use UDID as display name for stability.
     return std::string(udid != nullptr ? udid : "Unknown iOS Device");
 }
 
-bool read_remote_file_to_local(afc_client_t afc, const char* remote_path, const char* local_path) {
+// Streams a remote file into `out` starting at *offset, advancing *offset as
+// data lands so a retried call resumes where the previous attempt stopped.
+bool read_remote_to_stream(afc_client_t afc, SessionIo& io, const char* remote_path, std::ostream& out, uint64_t* offset) {
     auto& a = api();
+    const auto close_remote = [&](uint64_t handle) {
+        add_metric(g_metrics.afc_file_ops);
+        io.run(IOSB_IO_BULK, [&] { return a.afc_file_close(afc, handle); });
+    };
+
     uint64_t handle = 0;
-    if (a.afc_file_open(afc, remote_path, kAfcModeReadOnly, &handle) != 0) {
-        set_error("Failed to open remote file for reading.");
-        return false;
+    add_metric(g_metrics.afc_file_ops);
+    int rc = io.run(IOSB_IO_BULK, [&] { return a.afc_file_open(afc, remote_path, kAfcModeReadOnly, &handle); });
+    if (rc != 0) {
+        return afc_failure(rc, "Failed to open remote file for reading.");
     }
 
-    std::ofstream out(local_path, std::ios::binary | std::ios::trunc);
-    if (!out) {
-        a.afc_file_close(afc, handle);
-        set_error("Failed to open local output file.");
-        return false;
+    if (*offset > 0) {
+        add_metric(g_metrics.afc_file_ops);
+        rc = io.run(IOSB_IO_BULK, [&] { return a.afc_file_seek(afc, handle, static_cast<int64_t>(*offset), kAfcSeekSet); });
+        if (rc != 0) {
+            close_remote(handle);
+            return afc_failure(rc, "Failed to resume remote file read.");
+        }
     }
 
     std::vector<char> buffer(kChunkSize);
     while (true) {
         uint32_t bytes_read = 0;
-        const int rc = a.afc_file_read(afc, handle, buffer.data(), static_cast<uint32_t>(buffer.size()), &bytes_read);
+        add_metric(g_metrics.afc_file_ops);
+        rc = io.run(IOSB_IO_BULK, [&] {
+            return a.afc_file_read(afc, handle, buffer.data(), static_cast<uint32_t>(buffer.size()), &bytes_read);
+        });
         if (rc != 0) {
-            a.afc_file_close(afc, handle);
-            set_error("Failed while reading remote file.");
-            return false;
+            close_remote(handle);
+            return afc_failure(rc, "Failed while reading remote file.");
         }
         if (bytes_read == 0) {
             break;
         }
         out.write(buffer.data(), bytes_read);
         if (!out) {
-            a.afc_file_close(afc, handle);
+            close_remote(handle);
             set_error("Failed while writing local file.");
             return false;
         }
+        *offset += bytes_read;
+        add_metric(g_metrics.bytes_pulled, bytes_read);
+        io.throttle(bytes_read);
+    }
+
+    close_remote(handle);
+    return true;
+}
+
+// Pulls into local_path + ".part" and renames it over local_path once the
+// whole file has arrived, so a failed pull leaves an existing local file
+// untouched.
+bool read_remote_file_to_local(DeviceSession& session, const char* remote_path, const char* local_path) {
+    const std::string part_path = std::string(local_path) + ".part";
+    std::ofstream out(part_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        set_error("Failed to open local output file.");
+        return false;
+    }
+
+    uint64_t offset = 0;
+    bool ok = run_with_retry(session, [&](afc_client_t afc, SessionIo& io) {
+        return read_remote_to_stream(afc, io, remote_path, out, &offset);
+    });
+    out.close();
+    if (ok && !out) {
+        set_error("Failed while writing local file.");
+        ok = false;
+    }
+    if (ok && !MoveFileExA(part_path.c_str(), local_path, MOVEFILE_REPLACE_EXISTING)) {
+        const DWORD error = GetLastError();
+        set_error("Failed to replace local file: " + win32_error_message(error));
+        ok = false;
+    }
+    if (!ok) {
+        DeleteFileA(part_path.c_str());
+        return false;
+    }
+    add_metric(g_metrics.files_pulled);
+    return true;
+}
+
+// Collects the contents of small pulled files in one buffer and creates the
+// local files in bursts, so the AFC reads for a batch run back-to-back
+// instead of alternating with local file creation.
+class BatchedLocalWriter {
+public:
+    BatchedLocalWriter() {
+        buffer_.reserve(kBatchWriterCapacity);
+    }
+
+    ~BatchedLocalWriter() {
+        flush();
+    }
+
+    // Reserves room for a file of up to max_size bytes, flushing pending files
+    // first when the buffer cannot hold it. Returns the write position.
+    char* begin_file(size_t max_size) {
+        if (!buffer_.empty() && buffer_.size() + max_size > kBatchWriterCapacity) {
+            flush();
+        }
+        start_ = buffer_.size();
+        buffer_.resize(start_ + max_size);
+        return buffer_.data() + start_;
+    }
+
+    void commit_file(const char* local_path, size_t size, int* result) {
+        buffer_.resize(start_ + size);
+        pending_.push_back(PendingFile{local_path, start_, size, result});
+    }
+
+    void discard_file() {
+        buffer_.resize(start_);
+    }
+
+    void flush() {
+        if (pending_.empty()) {
+            return;
+        }
+        for (const PendingFile& file : pending_) {
+            std::ofstream out(file.local_path, std::ios::binary | std::ios::trunc);
+            if (out) {
+                out.write(buffer_.data() + file.offset, static_cast<std::streamsize>(file.size));
+            }
+            if (!out) {
+                *file.result = 0;
+                set_error(std::string("Failed to write local file: ") + file.local_path);
+            }
+        }
+        add_metric(g_metrics.batched_local_flushes);
+        pending_.clear();
+        buffer_.clear();
+    }
+
+private:
+    struct PendingFile {
+        const char* local_path;
+        size_t offset;
+        size_t size;
+        int* result;
+    };
+
+    std::vector<char> buffer_;
+    std::vector<PendingFile> pending_;
+    size_t start_ = 0;
+};
+
+// Small-file fast path: the size is already known from the listing, so one
+// read of known_size + 1 bytes returns the whole file and proves EOF without
+// the trailing zero-byte read. Sets *size_changed and fails without an AFC
+// error when the file no longer matches the listing.
+bool read_small_remote_file(afc_client_t afc, SessionIo& io, const char* remote_path, uint64_t known_size, BatchedLocalWriter& writer, const char* local_path, int* result, bool* size_changed) {
+    auto& a = api();
+    const uint32_t request = static_cast<uint32_t>(known_size + 1);
+    char* target = writer.begin_file(request);
+    uint32_t bytes_read = 0;
+    int rc = 0;
+    const char* failure = nullptr;
+
+    // open, read and close run in one turn: the whole file is a single chunk.
+    rc = io.run(IOSB_IO_BULK, [&] {
+        uint64_t handle = 0;
+        add_metric(g_metrics.afc_file_ops);
+        const int open_rc = a.afc_file_open(afc, remote_path, kAfcModeReadOnly, &handle);
+        if (open_rc != 0) {
+            failure = "Failed to open remote file for reading.";
+            return open_rc;
+        }
+        add_metric(g_metrics.afc_file_ops);
+        const int read_rc = a.afc_file_read(afc, handle, target, request, &bytes_read);
+        if (read_rc != 0) {
+            failure = "Failed while reading remote file.";
+        }
+        add_metric(g_metrics.afc_file_ops);
+        a.afc_file_close(afc, handle);
+        return read_rc;
+    });
+
+    if (rc != 0) {
+        writer.discard_file();
+        return failure != nullptr ? afc_failure(rc, failure) : false;
+    }
+    if (bytes_read != known_size) {
+        writer.discard_file();
+        *size_changed = true;
+        set_error("Remote file size changed since listing.");
+        return false;
     }
 
-    a.afc_file_close(afc, handle);
+    writer.commit_file(local_path, bytes_read, result);
+    add_metric(g_metrics.trailing_reads_skipped);
+    add_metric(g_metrics.small_file_pulls);
+    add_metric(g_metrics.files_pulled);
+    add_metric(g_metrics.bytes_pulled, bytes_read);
+    io.throttle(bytes_read);
     return true;
 }
 
-bool write_local_file_to_remote(afc_client_t afc, const char* local_path, const char* remote_path) {
+bool write_local_file_to_remote(afc_client_t afc, SessionIo& io, const char* local_path, const char* remote_path) {
     auto& a = api();
     std::ifstream in(local_path, std::ios::binary);
     if (!in) {
@@ -498,9 +1182,9 @@ bool write_local_file_to_remote(afc_client_t afc, const char* local_path, const
     }
 
     uint64_t handle = 0;
-    if (a.afc_file_open(afc, remote_path, kAfcModeWriteOnly, &handle) != 0) {
-        set_error("Failed to open remote file for writing.");
-        return false;
+    int rc = io.run(IOSB_IO_BULK, [&] { return a.afc_file_open(afc, remote_path, kAfcModeWriteOnly, &handle); });
+    if (rc != 0) {
+        return afc_failure(rc, "Failed to open remote file for writing.");
     }
 
     std::vector<char> buffer(kChunkSize);
@@ -512,84 +1196,1497 @@ bool write_local_file_to_remote(afc_client_t afc, const char* local_path, const
         }
 
         uint32_t bytes_written = 0;
-        const int rc = a.afc_file_write(
-            afc,
-            handle,
-            buffer.data(),
-            static_cast<uint32_t>(got),
-            &bytes_written);
+        rc = io.run(IOSB_IO_BULK, [&] {
+            return a.afc_file_write(
+                afc,
+                handle,
+                buffer.data(),
+                static_cast<uint32_t>(got),
+                &bytes_written);
+        });
         if (rc != 0 || bytes_written != static_cast<uint32_t>(got)) {
-            a.afc_file_close(afc, handle);
-            set_error("Failed while writing remote file.");
-            return false;
+            io.run(IOSB_IO_BULK, [&] { return a.afc_file_close(afc, handle); });
+            return afc_failure(rc != 0 ? rc : kAfcWriteError, "Failed while writing remote file.");
         }
+        io.throttle(static_cast<uint64_t>(got));
     }
 
-    a.afc_file_close(afc, handle);
+    io.run(IOSB_IO_BULK, [&] { return a.afc_file_close(afc, handle); });
     return true;
 }
 
-std::vector<Entry> list_entries(afc_client_t afc, const std::string& path, bool* ok) {
-    *ok = false;
-    std::vector<Entry> entries;
+// Forwards to the default heap and counts upstream allocations, so the
+// listing metrics show how often the arena had to grow.
+class CountingResource : public std::pmr::memory_resource {
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        add_metric(g_metrics.list_heap_allocations);
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
 
-    auto& a = api();
-    char** names = nullptr;
-    if (a.afc_read_directory(afc, path.c_str(), &names) != 0 || names == nullptr) {
-        set_error("Failed to list remote directory.");
-        return entries;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
     }
 
-    for (int i = 0; names[i] != nullptr; ++i) {
-        const std::string name = names[i];
-        if (name == "." || name == "..") {
-            continue;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// One directory listing backed by a per-call monotonic arena. Entry names are
+// views into the AFC name array, which stays alive until the listing is
+// destroyed, and the parent path (with trailing '/') is interned once, so
+// paths are only materialized when copied into the caller's structs.
+class DirectoryListing {
+public:
+    explicit DirectoryListing(const std::string& parent)
+        : arena_(initial_.data(), initial_.size(), &upstream_),
+          prefix_(&arena_),
+          scratch_(&arena_),
+          entries_(&arena_) {
+        prefix_.assign(parent);
+        if (prefix_.empty() || prefix_.back() != '/') {
+            prefix_.push_back('/');
+        }
+    }
+
+    ~DirectoryListing() {
+        if (names_ != nullptr) {
+            api().afc_dictionary_free(names_);
+        }
+    }
+
+    DirectoryListing(const DirectoryListing&) = delete;
+    DirectoryListing& operator=(const DirectoryListing&) = delete;
+
+    // Reads the directory, keeping at most max_entries entries. File info is
+    // only fetched for kept entries and only when with_info is set; a
+    // count-only query needs names alone. The read and each batch of
+    // kListingStatBatch stats take their own interactive turn, so a large
+    // listing lets other requests (and close or reconnect) in between.
+    bool load(afc_client_t afc, SessionIo& io, const std::string& path, size_t max_entries, bool with_info) {
+        auto& a = api();
+        const int rc = io.run(IOSB_IO_INTERACTIVE, [&] { return a.afc_read_directory(afc, path.c_str(), &names_); });
+        if (rc != 0 || names_ == nullptr) {
+            names_ = nullptr;
+            return afc_failure(rc != 0 ? rc : kAfcUnknownError, "Failed to list remote directory.");
+        }
+
+        size_t raw_count = 0;
+        while (names_[raw_count] != nullptr) {
+            ++raw_count;
+        }
+        entries_.reserve((std::min)(raw_count, max_entries));
+
+        const int64_t fallback_mtime = now_unix();
+        for (size_t i = 0; i < raw_count && entries_.size() < max_entries; ++i) {
+            const std::string_view name = names_[i];
+            if (name == "." || name == "..") {
+                continue;
+            }
+
+            Entry entry;
+            entry.name = name;
+            entry.modified_unix = fallback_mtime;
+            entries_.push_back(entry);
+        }
+
+        for (size_t first = 0; with_info && first < entries_.size(); first += kListingStatBatch) {
+            const size_t last = (std::min)(first + kListingStatBatch, entries_.size());
+            const int info_rc = io.run(IOSB_IO_INTERACTIVE, [&] {
+                for (size_t i = first; i < last; ++i) {
+                    const int entry_rc = stat_entry(afc, entries_[i]);
+                    if (is_transient_afc_error(entry_rc)) {
+                        return entry_rc;
+                    }
+                }
+                return static_cast<int>(kAfcSuccess);
+            });
+            if (info_rc != 0) {
+                // A dead connection would otherwise yield a listing of
+                // default-valued entries; fail so the listing is replayed.
+                return afc_failure(info_rc, "Failed to read remote file info.");
+            }
         }
 
-        Entry entry;
-        entry.name = name;
-        entry.path = join_path(path, name);
-        entry.modified_unix = now_unix();
+        add_metric(g_metrics.list_calls);
+        add_metric(g_metrics.list_entries, entries_.size());
+        return true;
+    }
+
+    size_t size() const {
+        return entries_.size();
+    }
+
+    void write_entry(size_t index, iosb_file_entry& out) const {
+        const Entry& entry = entries_[index];
+        std::memset(&out, 0, sizeof(iosb_file_entry));
+        copy_joined(out.path, IOSB_MAX_PATH, prefix_, entry.name);
+        copy_joined(out.name, IOSB_MAX_NAME, std::string_view(), entry.name);
+        out.is_directory = entry.is_directory ? 1 : 0;
+        out.size_bytes = entry.size_bytes;
+        out.modified_unix = entry.modified_unix;
+    }
 
+private:
+    // Fills in one entry's file info. Entries the device cannot stat keep
+    // their defaults; the AFC result is returned so the caller can tell a
+    // dropped connection from a vanished file.
+    int stat_entry(afc_client_t afc, Entry& entry) {
+        auto& a = api();
+        scratch_.assign(prefix_);
+        scratch_.append(entry.name);
         char** info = nullptr;
-        if (a.afc_get_file_info(afc, entry.path.c_str(), &info) == 0 && info != nullptr) {
+        const int rc = a.afc_get_file_info(afc, scratch_.c_str(), &info);
+        if (rc == 0 && info != nullptr) {
             entry.is_directory = dict_is_directory(info);
             entry.size_bytes = parse_u64(dict_value(info, "st_size"), 0);
             entry.modified_unix = parse_i64(dict_value(info, "st_mtime"), entry.modified_unix);
             a.afc_dictionary_free(info);
         }
-
-        entries.push_back(std::move(entry));
+        return rc;
     }
 
-    a.afc_dictionary_free(names);
-    *ok = true;
-    return entries;
-}
-
-}  // namespace
-
-extern "C" {
+    char** names_ = nullptr;
+    CountingResource upstream_;
+    std::array<std::byte, 16 * 1024> initial_;
+    std::pmr::monotonic_buffer_resource arena_;
+    std::pmr::string prefix_;
+    std::pmr::string scratch_;
+    std::pmr::vector<Entry> entries_;
+};
 
-int iosb_get_version(char* buffer, int buffer_size) {
-    if (!copy_text(buffer, buffer_size, kBackendVersion)) {
-        set_error("Version buffer too small");
-        return 0;
+std::shared_ptr<DeviceSession> find_session(int handle) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    const auto it = g_open_handles.find(handle);
+    if (it == g_open_handles.end()) {
+        set_error("Invalid or closed device handle");
+        return nullptr;
     }
-    return 1;
+    return it->second;
 }
 
-int iosb_get_last_error(char* buffer, int buffer_size) {
-    if (!copy_text(buffer, buffer_size, g_last_error)) {
-        return 0;
+std::unique_ptr<DirectoryListing> list_directory(DeviceSession& session, const std::string& remote_path, size_t max_entries, bool with_info) {
+    std::unique_ptr<DirectoryListing> listing;
+    const bool ok = run_with_retry(session, [&](afc_client_t afc, SessionIo& io) {
+        listing = std::make_unique<DirectoryListing>(remote_path);
+        return listing->load(afc, io, remote_path, max_entries, with_info);
+    });
+    if (!ok) {
+        listing.reset();
     }
-    return 1;
+    return listing;
 }
 
-int iosb_get_runtime_diagnostics(char* buffer, int buffer_size) {
-    const std::string details = build_runtime_diagnostics();
-    if (!copy_text(buffer, buffer_size, details)) {
-        set_error("Diagnostics buffer too small");
+bool stat_remote_path(DeviceSession& session, const std::string& remote_path, int io_class, iosb_file_entry& out) {
+    auto& a = api();
+    return run_with_retry(session, [&](afc_client_t afc, SessionIo& io) {
+        char** info = nullptr;
+        const int rc = io.run(io_class, [&] {
+            return a.afc_get_file_info(afc, remote_path.c_str(), &info);
+        });
+        if (rc != 0 || info == nullptr) {
+            return afc_failure(rc != 0 ? rc : kAfcUnknownError, "Failed to read remote file info.");
+        }
+
+        const size_t slash = remote_path.find_last_of('/');
+        std::memset(&out, 0, sizeof(iosb_file_entry));
+        copy_text(out.path, IOSB_MAX_PATH, remote_path);
+        copy_joined(out.name, IOSB_MAX_NAME, std::string_view(), std::string_view(remote_path).substr(slash + 1));
+        out.is_directory = dict_is_directory(info) ? 1 : 0;
+        out.size_bytes = parse_u64(dict_value(info, "st_size"), 0);
+        out.modified_unix = parse_i64(dict_value(info, "st_mtime"), now_unix());
+        a.afc_dictionary_free(info);
+        return true;
+    });
+}
+
+bool push_local_file(DeviceSession& session, const char* local_path, const std::string& remote_path) {
+    // The remote file is opened with truncation, so a retried push restarts
+    // from the beginning of the local file.
+    return run_with_retry(session, [&](afc_client_t afc, SessionIo& io) {
+        return write_local_file_to_remote(afc, io, local_path, remote_path.c_str());
+    });
+}
+
+// ---------------------------------------------------------------------------
+// Thumbnails. Previews are produced from as few remote bytes as possible:
+// the EXIF thumbnail of a JPEG, whatever WIC asks for when decoding a HEIC's
+// embedded thumbnail through a stream of ranged reads, and for MOV/MP4 the
+// cover art atom or else the first frame decoded by Media Foundation from
+// the moov index and the first samples. Results are scaled to fit max_edge, stored as JPEG in a
+// bounded on-disk cache keyed by path, size, mtime and edge, and evicted
+// oldest-first.
+// ---------------------------------------------------------------------------
+
+// Ranged reads of one remote file through a small block cache. The AFC
+// handle stays open between blocks and is reopened after a reconnect.
+// Reads run in the preview class: ahead of bulk transfers, but bounded so a
+// grid of thumbnails cannot starve a running pull, and outside the bulk
+// bandwidth cap.
+class RemoteRangeReader {
+public:
+    RemoteRangeReader(std::shared_ptr<DeviceSession> session, std::string remote_path, uint64_t size)
+        : session_(std::move(session)), remote_path_(std::move(remote_path)), size_(size) {}
+
+    ~RemoteRangeReader() {
+        if (!open_) {
+            return;
+        }
+        session_->io.run(IOSB_IO_PREVIEW, [&] {
+            std::shared_lock<std::shared_mutex> lock(session_->lock);
+            if (!session_->closed && session_->afc != nullptr && session_->generation == handle_generation_) {
+                api().afc_file_close(session_->afc, handle_);
+            }
+        });
+    }
+
+    RemoteRangeReader(const RemoteRangeReader&) = delete;
+    RemoteRangeReader& operator=(const RemoteRangeReader&) = delete;
+
+    uint64_t size() const {
+        return size_;
+    }
+
+    // Copies up to `length` bytes at `offset` into `out`; *out_read is short
+    // only at end of file.
+    bool read(uint64_t offset, size_t length, uint8_t* out, size_t* out_read) {
+        *out_read = 0;
+        while (*out_read < length && offset < size_) {
+            const uint64_t index = offset / kChunkSize;
+            const std::vector<uint8_t>* block = find_block(index);
+            if (block == nullptr) {
+                return false;
+            }
+            const size_t within = static_cast<size_t>(offset - index * kChunkSize);
+            if (within >= block->size()) {
+                break;
+            }
+            const size_t n = (std::min)(length - *out_read, block->size() - within);
+            std::memcpy(out + *out_read, block->data() + within, n);
+            *out_read += n;
+            offset += n;
+        }
+        return true;
+    }
+
+    bool read_exact(uint64_t offset, size_t length, uint8_t* out) {
+        size_t got = 0;
+        if (!read(offset, length, out, &got)) {
+            return false;
+        }
+        if (got != length) {
+            set_error("Unexpected end of remote file.");
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t kMaxCachedBlocks = 32;
+
+    const std::vector<uint8_t>* find_block(uint64_t index) {
+        for (const auto& cached : blocks_) {
+            if (cached.first == index) {
+                return &cached.second;
+            }
+        }
+
+        std::vector<uint8_t> block;
+        const bool ok = run_with_retry(*session_, [&](afc_client_t afc, SessionIo& io) {
+            return fetch_block(afc, io, index, block);
+        });
+        if (!ok) {
+            return nullptr;
+        }
+        add_metric(g_metrics.thumb_bytes_read, block.size());
+
+        if (blocks_.size() >= kMaxCachedBlocks) {
+            blocks_.pop_front();
+        }
+        blocks_.emplace_back(index, std::move(block));
+        return &blocks_.back().second;
+    }
+
+    bool fetch_block(afc_client_t afc, SessionIo& io, uint64_t index, std::vector<uint8_t>& block) {
+        auto& a = api();
+        if (!open_ || handle_generation_ != io.generation()) {
+            open_ = false;
+            const int rc = io.run(IOSB_IO_PREVIEW, [&] {
+                return a.afc_file_open(afc, remote_path_.c_str(), kAfcModeReadOnly, &handle_);
+            });
+            if (rc != 0) {
+                return afc_failure(rc, "Failed to open remote file for reading.");
+            }
+            open_ = true;
+            handle_generation_ = io.generation();
+        }
+
+        const uint64_t offset = index * kChunkSize;
+        int rc = io.run(IOSB_IO_PREVIEW, [&] {
+            return a.afc_file_seek(afc, handle_, static_cast<int64_t>(offset), kAfcSeekSet);
+        });
+        if (rc != 0) {
+            open_ = false;
+            return afc_failure(rc, "Failed to seek remote file.");
+        }
+
+        const size_t wanted = static_cast<size_t>((std::min)(static_cast<uint64_t>(kChunkSize), size_ - offset));
+        block.resize(wanted);
+        size_t filled = 0;
+        while (filled < wanted) {
+            uint32_t bytes_read = 0;
+            rc = io.run(IOSB_IO_PREVIEW, [&] {
+                return a.afc_file_read(afc, handle_, reinterpret_cast<char*>(block.data() + filled), static_cast<uint32_t>(wanted - filled), &bytes_read);
+            });
+            if (rc != 0) {
+                open_ = false;
+                return afc_failure(rc, "Failed while reading remote file.");
+            }
+            if (bytes_read == 0) {
+                break;
+            }
+            filled += bytes_read;
+        }
+        block.resize(filled);
+        return true;
+    }
+
+    std::shared_ptr<DeviceSession> session_;
+    std::string remote_path_;
+    uint64_t size_;
+    uint64_t handle_ = 0;
+    uint64_t handle_generation_ = 0;
+    bool open_ = false;
+    std::deque<std::pair<uint64_t, std::vector<uint8_t>>> blocks_;
+};
+
+// Read-only IStream over a RemoteRangeReader, so WIC decoders pull only the
+// byte ranges they touch. Heap-allocated and reference counted: a codec may
+// keep the stream (and with it the reader and session) past the decode.
+class RemoteRangeStream final : public IStream {
+public:
+    static Microsoft::WRL::ComPtr<IStream> create(std::shared_ptr<RemoteRangeReader> reader, uint64_t position = 0) {
+        Microsoft::WRL::ComPtr<IStream> stream;
+        stream.Attach(new RemoteRangeStream(std::move(reader), position));
+        return stream;
+    }
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** object) override {
+        if (object == nullptr) {
+            return E_POINTER;
+        }
+        if (riid == IID_IUnknown || riid == IID_ISequentialStream || riid == IID_IStream) {
+            *object = static_cast<IStream*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *object = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    ULONG STDMETHODCALLTYPE AddRef() override {
+        return static_cast<ULONG>(InterlockedIncrement(&refs_));
+    }
+
+    ULONG STDMETHODCALLTYPE Release() override {
+        const long refs = InterlockedDecrement(&refs_);
+        if (refs == 0) {
+            delete this;
+        }
+        return static_cast<ULONG>(refs);
+    }
+
+    HRESULT STDMETHODCALLTYPE Read(void* buffer, ULONG size, ULONG* bytes_read) override {
+        size_t got = 0;
+        if (!reader_->read(position_, size, static_cast<uint8_t*>(buffer), &got)) {
+            return STG_E_READFAULT;
+        }
+        position_ += got;
+        if (bytes_read != nullptr) {
+            *bytes_read = static_cast<ULONG>(got);
+        }
+        return got == size ? S_OK : S_FALSE;
+    }
+
+    HRESULT STDMETHODCALLTYPE Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* new_position) override {
+        int64_t base = 0;
+        switch (origin) {
+            case STREAM_SEEK_SET:
+                base = 0;
+                break;
+            case STREAM_SEEK_CUR:
+                base = static_cast<int64_t>(position_);
+                break;
+            case STREAM_SEEK_END:
+                base = static_cast<int64_t>(reader_->size());
+                break;
+            default:
+                return STG_E_INVALIDFUNCTION;
+        }
+        const int64_t target = base + move.QuadPart;
+        if (target < 0) {
+            return STG_E_INVALIDFUNCTION;
+        }
+        position_ = static_cast<uint64_t>(target);
+        if (new_position != nullptr) {
+            new_position->QuadPart = position_;
+        }
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE Stat(STATSTG* stat, DWORD) override {
+        if (stat == nullptr) {
+            return E_POINTER;
+        }
+        std::memset(stat, 0, sizeof(STATSTG));
+        stat->type = STGTY_STREAM;
+        stat->cbSize.QuadPart = reader_->size();
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE Write(const void*, ULONG, ULONG*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE SetSize(ULARGE_INTEGER) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE CopyTo(IStream*, ULARGE_INTEGER, ULARGE_INTEGER*, ULARGE_INTEGER*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE Commit(DWORD) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE Revert() override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE LockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE UnlockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD) override { return E_NOTIMPL; }
+
+    HRESULT STDMETHODCALLTYPE Clone(IStream** clone) override {
+        if (clone == nullptr) {
+            return E_POINTER;
+        }
+        *clone = new RemoteRangeStream(reader_, position_);
+        return S_OK;
+    }
+
+private:
+    RemoteRangeStream(std::shared_ptr<RemoteRangeReader> reader, uint64_t position)
+        : reader_(std::move(reader)), position_(position) {}
+
+    ~RemoteRangeStream() = default;
+
+    std::shared_ptr<RemoteRangeReader> reader_;
+    uint64_t position_;
+    volatile long refs_ = 1;
+};
+
+uint16_t read_u16(const uint8_t* p, bool little_endian) {
+    return little_endian ? static_cast<uint16_t>(p[0] | (p[1] << 8)) : static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+uint32_t read_u32(const uint8_t* p, bool little_endian) {
+    return little_endian
+        ? static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24)
+        : (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+uint64_t read_u64_be(const uint8_t* p) {
+    return (static_cast<uint64_t>(read_u32(p, false)) << 32) | read_u32(p + 4, false);
+}
+
+// Locates the JPEG thumbnail in IFD1 of a TIFF/EXIF block.
+bool find_tiff_thumbnail(const uint8_t* tiff, size_t size, size_t* out_offset, size_t* out_length) {
+    if (size < 8) {
+        return false;
+    }
+    bool le = false;
+    if (tiff[0] == 'I' && tiff[1] == 'I') {
+        le = true;
+    } else if (!(tiff[0] == 'M' && tiff[1] == 'M')) {
+        return false;
+    }
+    if (read_u16(tiff + 2, le) != 42) {
+        return false;
+    }
+
+    const uint32_t ifd0 = read_u32(tiff + 4, le);
+    if (static_cast<size_t>(ifd0) + 2 > size) {
+        return false;
+    }
+    const uint32_t ifd0_entries = read_u16(tiff + ifd0, le);
+    const size_t next_at = ifd0 + 2 + static_cast<size_t>(ifd0_entries) * 12;
+    if (next_at + 4 > size) {
+        return false;
+    }
+    const uint32_t ifd1 = read_u32(tiff + next_at, le);
+    if (ifd1 == 0 || static_cast<size_t>(ifd1) + 2 > size) {
+        return false;
+    }
+
+    const uint32_t entries = read_u16(tiff + ifd1, le);
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    for (uint32_t i = 0; i < entries; ++i) {
+        const size_t entry = ifd1 + 2 + static_cast<size_t>(i) * 12;
+        if (entry + 12 > size) {
+            return false;
+        }
+        const uint16_t tag = read_u16(tiff + entry, le);
+        if (tag == 0x0201) {
+            offset = read_u32(tiff + entry + 8, le);
+        } else if (tag == 0x0202) {
+            length = read_u32(tiff + entry + 8, le);
+        }
+    }
+    if (offset == 0 || length == 0 || offset > size || length > size - offset) {
+        return false;
+    }
+    *out_offset = offset;
+    *out_length = length;
+    return true;
+}
+
+// Walks the JPEG markers up to the first scan looking for an APP1 Exif
+// segment with an embedded thumbnail. Offsets are relative to `data`.
+bool find_exif_thumbnail(const uint8_t* data, size_t size, size_t* out_offset, size_t* out_length) {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return false;
+    }
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) {
+            return false;
+        }
+        const uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {
+            ++pos;
+            continue;
+        }
+        if (marker == 0xDA || marker == 0xD9) {
+            return false;
+        }
+        const size_t segment_length = read_u16(data + pos + 2, false);
+        const size_t body = pos + 4;
+        if (segment_length < 2) {
+            return false;
+        }
+        if (marker == 0xE1 && segment_length >= 8 && body + 6 <= size && std::memcmp(data + body, "Exif\0\0", 6) == 0) {
+            const size_t tiff = body + 6;
+            const size_t tiff_size = (std::min)(segment_length - 8, size - tiff);
+            size_t offset = 0;
+            if (find_tiff_thumbnail(data + tiff, tiff_size, &offset, out_length)) {
+                *out_offset = tiff + offset;
+                return true;
+            }
+        }
+        pos += 2 + segment_length;
+    }
+    return false;
+}
+
+// Finds the first child box of `type` within [begin, end) of an ISO BMFF /
+// QuickTime file. Box headers are tiny reads served from the block cache.
+bool find_box(RemoteRangeReader& reader, uint64_t begin, uint64_t end, const char* type, uint64_t* out_body, uint64_t* out_end) {
+    uint64_t pos = begin;
+    while (pos <= end && end - pos >= 8) {
+        uint8_t header[16] = {};
+        if (!reader.read_exact(pos, 8, header)) {
+            return false;
+        }
+        uint64_t box_size = read_u32(header, false);
+        uint64_t body = pos + 8;
+        if (box_size == 1) {
+            if (!reader.read_exact(pos + 8, 8, header + 8)) {
+                return false;
+            }
+            box_size = read_u64_be(header + 8);
+            body = pos + 16;
+        } else if (box_size == 0) {
+            box_size = end - pos;
+        }
+        // Compared against the space left so a 64-bit size cannot wrap.
+        if (box_size < body - pos || box_size > end - pos) {
+            return false;
+        }
+        if (std::memcmp(header + 4, type, 4) == 0) {
+            *out_body = body;
+            *out_end = pos + box_size;
+            return true;
+        }
+        pos += box_size;
+    }
+    return false;
+}
+
+// Extracts cover art (moov/udta/meta/ilst/covr/data) from a MOV/MP4. Only the
+// box headers along that path and the image payload are read.
+bool read_movie_cover_art(RemoteRangeReader& reader, std::vector<uint8_t>& out) {
+    uint64_t body = 0;
+    uint64_t end = 0;
+    if (!find_box(reader, 0, reader.size(), "moov", &body, &end) ||
+        !find_box(reader, body, end, "udta", &body, &end) ||
+        !find_box(reader, body, end, "meta", &body, &end)) {
+        return false;
+    }
+
+    // MP4 'meta' is a full box (4 bytes of version/flags); QuickTime's is not.
+    uint8_t probe[4] = {};
+    if (body + 4 <= end && reader.read_exact(body, 4, probe) && read_u32(probe, false) == 0) {
+        body += 4;
+    }
+    if (!find_box(reader, body, end, "ilst", &body, &end) ||
+        !find_box(reader, body, end, "covr", &body, &end) ||
+        !find_box(reader, body, end, "data", &body, &end)) {
+        return false;
+    }
+
+    // 'data' payload: 4 bytes type indicator, 4 bytes locale, then the image.
+    if (end < body + 8 || end - body - 8 > kPreviewFullReadLimit) {
+        return false;
+    }
+    out.resize(static_cast<size_t>(end - body - 8));
+    return reader.read_exact(body + 8, out.size(), out.data());
+}
+
+std::string lowercase_extension(const std::string& path) {
+    const size_t dot = path.find_last_of('.');
+    const size_t slash = path.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return std::string();
+    }
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return ext;
+}
+
+uint64_t fnv1a64(std::string_view text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const char c : text) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Joins the MTA for WIC work for the lifetime of the scope. A thread that
+// already joined an apartment (e.g. the UI thread's STA) keeps it. Scopes
+// are owned by async workers and by sync calls, never by thread-exit
+// destructors, which would run COM teardown under the loader lock.
+class ComScope {
+public:
+    ComScope() : hr_(CoInitializeEx(nullptr, COINIT_MULTITHREADED)) {}
+
+    ~ComScope() {
+        if (SUCCEEDED(hr_)) {
+            CoUninitialize();
+        }
+    }
+
+    ComScope(const ComScope&) = delete;
+    ComScope& operator=(const ComScope&) = delete;
+
+    bool ok() const {
+        return SUCCEEDED(hr_) || hr_ == RPC_E_CHANGED_MODE;
+    }
+
+private:
+    HRESULT hr_;
+};
+
+bool hr_failure(HRESULT hr, const char* message) {
+    char code[16] = {};
+    std::snprintf(code, sizeof(code), "0x%08lX", static_cast<unsigned long>(hr));
+    set_error(std::string(message) + " (HRESULT " + code + ")");
+    return false;
+}
+
+// Scales `source` to fit within max_edge and writes it as a JPEG file.
+bool encode_thumbnail(IWICImagingFactory* factory, IWICBitmapSource* source, int max_edge, const std::string& local_path) {
+    UINT width = 0;
+    UINT height = 0;
+    HRESULT hr = source->GetSize(&width, &height);
+    if (FAILED(hr) || width == 0 || height == 0) {
+        return hr_failure(hr, "Preview has no usable size.");
+    }
+    const double scale = (std::min)(1.0, static_cast<double>(max_edge) / static_cast<double>((std::max)(width, height)));
+    const UINT out_width = (std::max)(1u, static_cast<UINT>(width * scale));
+    const UINT out_height = (std::max)(1u, static_cast<UINT>(height * scale));
+
+    Microsoft::WRL::ComPtr<IWICBitmapScaler> scaler;
+    Microsoft::WRL::ComPtr<IWICFormatConverter> converter;
+    if (FAILED(hr = factory->CreateBitmapScaler(scaler.GetAddressOf())) ||
+        FAILED(hr = scaler->Initialize(source, out_width, out_height, WICBitmapInterpolationModeFant)) ||
+        FAILED(hr = factory->CreateFormatConverter(converter.GetAddressOf())) ||
+        FAILED(hr = converter->Initialize(scaler.Get(), GUID_WICPixelFormat24bppBGR, WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom))) {
+        return hr_failure(hr, "Failed to scale preview.");
+    }
+
+    std::wstring wide_path(local_path.size() + 1, L'\0');
+    const int wide_len = MultiByteToWideChar(CP_ACP, 0, local_path.c_str(), -1, &wide_path[0], static_cast<int>(wide_path.size()));
+    if (wide_len <= 0) {
+        set_error("Invalid thumbnail cache path.");
+        return false;
+    }
+
+    Microsoft::WRL::ComPtr<IWICStream> stream;
+    Microsoft::WRL::ComPtr<IWICBitmapEncoder> encoder;
+    Microsoft::WRL::ComPtr<IWICBitmapFrameEncode> frame;
+    WICPixelFormatGUID format = GUID_WICPixelFormat24bppBGR;
+    if (FAILED(hr = factory->CreateStream(stream.GetAddressOf())) ||
+        FAILED(hr = stream->InitializeFromFilename(wide_path.c_str(), GENERIC_WRITE)) ||
+        FAILED(hr = factory->CreateEncoder(GUID_ContainerFormatJpeg, nullptr, encoder.GetAddressOf())) ||
+        FAILED(hr = encoder->Initialize(stream.Get(), WICBitmapEncoderNoCache)) ||
+        FAILED(hr = encoder->CreateNewFrame(frame.GetAddressOf(), nullptr)) ||
+        FAILED(hr = frame->Initialize(nullptr)) ||
+        FAILED(hr = frame->SetSize(out_width, out_height)) ||
+        FAILED(hr = frame->SetPixelFormat(&format)) ||
+        FAILED(hr = frame->WriteSource(converter.Get(), nullptr)) ||
+        FAILED(hr = frame->Commit()) ||
+        FAILED(hr = encoder->Commit())) {
+        return hr_failure(hr, "Failed to encode thumbnail.");
+    }
+    return true;
+}
+
+// Decodes an in-memory image (EXIF thumbnail, cover art, small file).
+bool encode_thumbnail_from_memory(IWICImagingFactory* factory, std::vector<uint8_t>& bytes, int max_edge, const std::string& local_path) {
+    Microsoft::WRL::ComPtr<IWICStream> stream;
+    Microsoft::WRL::ComPtr<IWICBitmapDecoder> decoder;
+    Microsoft::WRL::ComPtr<IWICBitmapFrameDecode> frame;
+    HRESULT hr = S_OK;
+    if (FAILED(hr = factory->CreateStream(stream.GetAddressOf())) ||
+        FAILED(hr = stream->InitializeFromMemory(bytes.data(), static_cast<DWORD>(bytes.size()))) ||
+        FAILED(hr = factory->CreateDecoderFromStream(stream.Get(), nullptr, WICDecodeMetadataCacheOnDemand, decoder.GetAddressOf())) ||
+        FAILED(hr = decoder->GetFrame(0, frame.GetAddressOf()))) {
+        return hr_failure(hr, "Failed to decode preview image.");
+    }
+    return encode_thumbnail(factory, frame.Get(), max_edge, local_path);
+}
+
+// Lets WIC decode straight from the device: the embedded thumbnail when the
+// codec exposes one (HEIC, JPEG, TIFF...), otherwise the full image if the
+// file is small enough to read whole.
+bool encode_thumbnail_from_remote(IWICImagingFactory* factory, const std::shared_ptr<RemoteRangeReader>& reader, int max_edge, const std::string& local_path) {
+    const Microsoft::WRL::ComPtr<IStream> stream = RemoteRangeStream::create(reader);
+    Microsoft::WRL::ComPtr<IWICBitmapDecoder> decoder;
+    Microsoft::WRL::ComPtr<IWICBitmapFrameDecode> frame;
+    HRESULT hr = S_OK;
+    if (FAILED(hr = factory->CreateDecoderFromStream(stream.Get(), nullptr, WICDecodeMetadataCacheOnDemand, decoder.GetAddressOf())) ||
+        FAILED(hr = decoder->GetFrame(0, frame.GetAddressOf()))) {
+        return hr_failure(hr, "No image decoder available for this file.");
+    }
+
+    Microsoft::WRL::ComPtr<IWICBitmapSource> thumbnail;
+    if (SUCCEEDED(frame->GetThumbnail(thumbnail.GetAddressOf())) ||
+        SUCCEEDED(decoder->GetThumbnail(thumbnail.ReleaseAndGetAddressOf()))) {
+        return encode_thumbnail(factory, thumbnail.Get(), max_edge, local_path);
+    }
+    if (reader->size() > kPreviewFullReadLimit) {
+        set_error("File has no embedded preview and is too large to decode.");
+        return false;
+    }
+    return encode_thumbnail(factory, frame.Get(), max_edge, local_path);
+}
+
+// Media Foundation is started once per process and never shut down; an
+// MFShutdown at DLL unload would run under the loader lock.
+bool ensure_media_foundation() {
+    static std::once_flag once;
+    static HRESULT started = E_FAIL;
+    std::call_once(once, [] { started = MFStartup(MF_VERSION, MFSTARTUP_LITE); });
+    if (FAILED(started)) {
+        return hr_failure(started, "Failed to start Media Foundation.");
+    }
+    return true;
+}
+
+// Copies a decoded RGB32 sample into a top-down BGRX bitmap.
+bool copy_video_frame(IMFSample* sample, UINT32 width, UINT32 height, LONG default_stride, std::vector<uint8_t>& pixels) {
+    Microsoft::WRL::ComPtr<IMFMediaBuffer> buffer;
+    HRESULT hr = sample->ConvertToContiguousBuffer(buffer.GetAddressOf());
+    if (FAILED(hr)) {
+        return hr_failure(hr, "Failed to read video frame.");
+    }
+
+    const size_t row_bytes = static_cast<size_t>(width) * 4;
+    pixels.resize(row_bytes * height);
+    Microsoft::WRL::ComPtr<IMF2DBuffer> buffer_2d;
+    BYTE* scanline0 = nullptr;
+    LONG pitch = 0;
+    if (SUCCEEDED(buffer.As(&buffer_2d)) && SUCCEEDED(buffer_2d->Lock2D(&scanline0, &pitch))) {
+        for (UINT32 y = 0; y < height; ++y) {
+            std::memcpy(pixels.data() + y * row_bytes, scanline0 + static_cast<ptrdiff_t>(y) * pitch, row_bytes);
+        }
+        buffer_2d->Unlock2D();
+        return true;
+    }
+
+    BYTE* data = nullptr;
+    DWORD length = 0;
+    if (FAILED(hr = buffer->Lock(&data, nullptr, &length))) {
+        return hr_failure(hr, "Failed to read video frame.");
+    }
+    // A negative default stride means a bottom-up frame.
+    const size_t abs_stride = static_cast<size_t>(default_stride < 0 ? -default_stride : default_stride);
+    const bool fits = abs_stride >= row_bytes && length >= abs_stride * height;
+    if (fits) {
+        for (UINT32 y = 0; y < height; ++y) {
+            const UINT32 row = default_stride < 0 ? height - 1 - y : y;
+            std::memcpy(pixels.data() + y * row_bytes, data + row * abs_stride, row_bytes);
+        }
+    }
+    buffer->Unlock();
+    if (!fits) {
+        set_error("Decoded video frame is smaller than its format.");
+    }
+    return fits;
+}
+
+// Decodes the first video frame of a MOV/MP4 through Media Foundation. The
+// source reader pulls the moov index and the first samples through ranged
+// reads, never the whole file. HEVC videos need the Windows HEVC extension.
+bool encode_thumbnail_from_movie_frame(IWICImagingFactory* factory, const std::shared_ptr<RemoteRangeReader>& reader, int max_edge, const std::string& local_path) {
+    if (!ensure_media_foundation()) {
+        return false;
+    }
+
+    const Microsoft::WRL::ComPtr<IStream> stream = RemoteRangeStream::create(reader);
+    Microsoft::WRL::ComPtr<IMFByteStream> byte_stream;
+    Microsoft::WRL::ComPtr<IMFAttributes> attributes;
+    Microsoft::WRL::ComPtr<IMFSourceReader> source;
+    Microsoft::WRL::ComPtr<IMFMediaType> rgb32;
+    const DWORD video = static_cast<DWORD>(MF_SOURCE_READER_FIRST_VIDEO_STREAM);
+    HRESULT hr = S_OK;
+    if (FAILED(hr = MFCreateMFByteStreamOnStream(stream.Get(), byte_stream.GetAddressOf())) ||
+        FAILED(hr = MFCreateAttributes(attributes.GetAddressOf(), 1)) ||
+        FAILED(hr = attributes->SetUINT32(MF_SOURCE_READER_ENABLE_VIDEO_PROCESSING, TRUE)) ||
+        FAILED(hr = MFCreateSourceReaderFromByteStream(byte_stream.Get(), attributes.Get(), source.GetAddressOf())) ||
+        FAILED(hr = source->SetStreamSelection(static_cast<DWORD>(MF_SOURCE_READER_ALL_STREAMS), FALSE)) ||
+        FAILED(hr = source->SetStreamSelection(video, TRUE)) ||
+        FAILED(hr = MFCreateMediaType(rgb32.GetAddressOf())) ||
+        FAILED(hr = rgb32->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video)) ||
+        FAILED(hr = rgb32->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB32)) ||
+        FAILED(hr = source->SetCurrentMediaType(video, nullptr, rgb32.Get()))) {
+        return hr_failure(hr, "No video decoder available for this file.");
+    }
+
+    Microsoft::WRL::ComPtr<IMFSample> sample;
+    for (int i = 0; i < kMaxMovieSampleReads && !sample; ++i) {
+        DWORD flags = 0;
+        if (FAILED(hr = source->ReadSample(video, 0, nullptr, &flags, nullptr, sample.ReleaseAndGetAddressOf()))) {
+            return hr_failure(hr, "Failed to decode video frame.");
+        }
+        if ((flags & MF_SOURCE_READERF_ENDOFSTREAM) != 0) {
+            break;
+        }
+    }
+    if (!sample) {
+        set_error("Video has no decodable frame.");
+        return false;
+    }
+
+    // Read the format after the first sample: the decoder may have changed it.
+    Microsoft::WRL::ComPtr<IMFMediaType> format;
+    UINT32 width = 0;
+    UINT32 height = 0;
+    if (FAILED(hr = source->GetCurrentMediaType(video, format.GetAddressOf())) ||
+        FAILED(hr = MFGetAttributeSize(format.Get(), MF_MT_FRAME_SIZE, &width, &height)) ||
+        width == 0 || height == 0) {
+        return hr_failure(hr, "Video frame has no usable size.");
+    }
+    const LONG default_stride = static_cast<LONG>(MFGetAttributeUINT32(format.Get(), MF_MT_DEFAULT_STRIDE, width * 4));
+    std::vector<uint8_t> pixels;
+    if (!copy_video_frame(sample.Get(), width, height, default_stride, pixels)) {
+        return false;
+    }
+
+    Microsoft::WRL::ComPtr<IWICBitmap> bitmap;
+    if (FAILED(hr = factory->CreateBitmapFromMemory(width, height, GUID_WICPixelFormat32bppBGR, width * 4, static_cast<UINT>(pixels.size()), pixels.data(), bitmap.GetAddressOf()))) {
+        return hr_failure(hr, "Failed to wrap video frame.");
+    }
+
+    // MF_MT_VIDEO_ROTATION is the counter-clockwise rotation needed for
+    // display (portrait iPhone videos); WIC rotates clockwise.
+    WICBitmapTransformOptions transform = WICBitmapTransformRotate0;
+    switch (MFGetAttributeUINT32(format.Get(), MF_MT_VIDEO_ROTATION, 0)) {
+        case 90:
+            transform = WICBitmapTransformRotate270;
+            break;
+        case 180:
+            transform = WICBitmapTransformRotate180;
+            break;
+        case 270:
+            transform = WICBitmapTransformRotate90;
+            break;
+        default:
+            break;
+    }
+    if (transform == WICBitmapTransformRotate0) {
+        return encode_thumbnail(factory, bitmap.Get(), max_edge, local_path);
+    }
+    Microsoft::WRL::ComPtr<IWICBitmapFlipRotator> rotator;
+    if (FAILED(hr = factory->CreateBitmapFlipRotator(rotator.GetAddressOf())) ||
+        FAILED(hr = rotator->Initialize(bitmap.Get(), transform))) {
+        return hr_failure(hr, "Failed to rotate video frame.");
+    }
+    return encode_thumbnail(factory, rotator.Get(), max_edge, local_path);
+}
+
+// Bounded on-disk store of generated thumbnails. Hits refresh the file's
+// write time, and eviction removes the oldest files until the store is back
+// under 90% of its budget.
+class ThumbnailCache {
+public:
+    bool configure(const char* directory, uint64_t max_bytes) {
+        std::string dir = directory != nullptr ? directory : "";
+        while (!dir.empty() && (dir.back() == '\\' || dir.back() == '/')) {
+            dir.pop_back();
+        }
+        if (dir.empty()) {
+            set_error("Thumbnail cache directory cannot be empty");
+            return false;
+        }
+        if (max_bytes == 0) {
+            set_error("Thumbnail cache size must be greater than zero");
+            return false;
+        }
+        if (!CreateDirectoryA(dir.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS) {
+            set_error("Failed to create thumbnail cache directory: " + win32_error_message(GetLastError()));
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        directory_ = dir;
+        max_bytes_ = max_bytes;
+        total_bytes_ = scan_locked(nullptr);
+        evict_locked(nullptr);
+        return true;
+    }
+
+    bool path_for(const std::string& key, std::string* out_path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (directory_.empty()) {
+            set_error("Thumbnail cache is not configured. Call iosb_set_thumbnail_cache first.");
+            return false;
+        }
+        char name[32] = {};
+        std::snprintf(name, sizeof(name), "%016llx.jpg", static_cast<unsigned long long>(fnv1a64(key)));
+        *out_path = directory_ + "\\" + name;
+        return true;
+    }
+
+    bool lookup(const std::string& path) {
+        HANDLE file = CreateFileA(path.c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        FILETIME now = {};
+        GetSystemTimeAsFileTime(&now);
+        SetFileTime(file, nullptr, nullptr, &now);
+        CloseHandle(file);
+        return true;
+    }
+
+    // Moves a finished temp file into place and enforces the size budget.
+    bool commit(const std::string& temp_path, const std::string& final_path) {
+        std::ifstream probe(temp_path, std::ios::binary | std::ios::ate);
+        const uint64_t bytes = probe ? static_cast<uint64_t>(probe.tellg()) : 0;
+        probe.close();
+        if (!MoveFileExA(temp_path.c_str(), final_path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+            const DWORD error = GetLastError();
+            DeleteFileA(temp_path.c_str());
+            set_error("Failed to store thumbnail: " + win32_error_message(error));
+            return false;
+        }
+
+        // The new thumbnail is about to be returned to the caller, so it is
+        // never an eviction candidate, even when it alone exceeds the budget.
+        const std::string name = final_path.substr(final_path.find_last_of("\\/") + 1);
+        std::lock_guard<std::mutex> lock(mutex_);
+        total_bytes_ += bytes;
+        if (total_bytes_ > max_bytes_) {
+            evict_locked(&name);
+        }
+        return true;
+    }
+
+private:
+    struct CachedFile {
+        FILETIME last_write;
+        uint64_t size;
+        std::string name;
+    };
+
+    uint64_t scan_locked(std::vector<CachedFile>* out_files) {
+        uint64_t total = 0;
+        WIN32_FIND_DATAA data = {};
+        HANDLE find = FindFirstFileA((directory_ + "\\*.jpg").c_str(), &data);
+        if (find == INVALID_HANDLE_VALUE) {
+            return 0;
+        }
+        do {
+            const uint64_t size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+            total += size;
+            if (out_files != nullptr) {
+                out_files->push_back(CachedFile{data.ftLastWriteTime, size, data.cFileName});
+            }
+        } while (FindNextFileA(find, &data));
+        FindClose(find);
+        return total;
+    }
+
+    // Removes the least recently used files except `keep` (a file name).
+    void evict_locked(const std::string* keep) {
+        std::vector<CachedFile> files;
+        total_bytes_ = scan_locked(&files);
+        if (total_bytes_ <= max_bytes_) {
+            return;
+        }
+        std::sort(files.begin(), files.end(), [](const CachedFile& l, const CachedFile& r) {
+            return CompareFileTime(&l.last_write, &r.last_write) < 0;
+        });
+        const uint64_t target = max_bytes_ / 10 * 9;
+        for (const CachedFile& file : files) {
+            if (total_bytes_ <= target) {
+                break;
+            }
+            if (keep != nullptr && file.name == *keep) {
+                continue;
+            }
+            if (DeleteFileA((directory_ + "\\" + file.name).c_str())) {
+                total_bytes_ -= file.size;
+                add_metric(g_metrics.thumb_evictions);
+            }
+        }
+    }
+
+    std::mutex mutex_;
+    std::string directory_;
+    uint64_t max_bytes_ = 0;
+    uint64_t total_bytes_ = 0;
+};
+
+ThumbnailCache& thumbnail_cache() {
+    static ThumbnailCache instance;
+    return instance;
+}
+
+// Produces (or finds) the cached thumbnail for a remote image or movie and
+// returns its local path. The calling thread must hold a ComScope.
+bool generate_thumbnail(DeviceSession& session, const std::string& remote_path, int max_edge, std::string* out_local_path) {
+    add_metric(g_metrics.thumb_requests);
+    if (max_edge <= 0) {
+        max_edge = kDefaultThumbnailEdge;
+    }
+    max_edge = (std::min)(max_edge, kMaxThumbnailEdge);
+
+    iosb_file_entry info;
+    if (!stat_remote_path(session, remote_path, IOSB_IO_PREVIEW, info)) {
+        return false;
+    }
+    if (info.is_directory != 0) {
+        set_error("Cannot generate a thumbnail for a directory.");
+        return false;
+    }
+
+    const std::string key = remote_path + "|" + std::to_string(static_cast<unsigned long long>(info.size_bytes)) + "|" +
+        std::to_string(static_cast<long long>(info.modified_unix)) + "|" + std::to_string(max_edge);
+    auto& cache = thumbnail_cache();
+    if (!cache.path_for(key, out_local_path)) {
+        return false;
+    }
+    if (cache.lookup(*out_local_path)) {
+        add_metric(g_metrics.thumb_cache_hits);
+        return true;
+    }
+
+    Microsoft::WRL::ComPtr<IWICImagingFactory> factory;
+    HRESULT hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(factory.GetAddressOf()));
+    if (FAILED(hr)) {
+        return hr_failure(hr, "Failed to create WIC imaging factory.");
+    }
+
+    char suffix[48] = {};
+    std::snprintf(suffix, sizeof(suffix), ".%lu.%lu.tmp", static_cast<unsigned long>(GetCurrentProcessId()), static_cast<unsigned long>(GetCurrentThreadId()));
+    const std::string temp_path = *out_local_path + suffix;
+
+    const auto reader = std::make_shared<RemoteRangeReader>(session.shared_from_this(), remote_path, info.size_bytes);
+    const std::string ext = lowercase_extension(remote_path);
+    bool ok = false;
+    if (ext == "jpg" || ext == "jpeg") {
+        std::vector<uint8_t> head(static_cast<size_t>((std::min)(info.size_bytes, kJpegHeaderReadSize)));
+        size_t offset = 0;
+        size_t length = 0;
+        if (reader->read_exact(0, head.size(), head.data()) && find_exif_thumbnail(head.data(), head.size(), &offset, &length)) {
+            std::vector<uint8_t> thumbnail(head.begin() + offset, head.begin() + offset + length);
+            ok = encode_thumbnail_from_memory(factory.Get(), thumbnail, max_edge, temp_path);
+        } else {
+            ok = encode_thumbnail_from_remote(factory.Get(), reader, max_edge, temp_path);
+        }
+    } else if (ext == "mov" || ext == "mp4" || ext == "m4v") {
+        // Cover art costs a few box-header reads; most camera videos have
+        // none, so fall back to decoding the first frame.
+        std::vector<uint8_t> cover;
+        if (read_movie_cover_art(*reader, cover)) {
+            ok = encode_thumbnail_from_memory(factory.Get(), cover, max_edge, temp_path);
+        } else {
+            ok = encode_thumbnail_from_movie_frame(factory.Get(), reader, max_edge, temp_path);
+        }
+    } else {
+        ok = encode_thumbnail_from_remote(factory.Get(), reader, max_edge, temp_path);
+    }
+
+    if (!ok) {
+        DeleteFileA(temp_path.c_str());
+        add_metric(g_metrics.thumb_failures);
+        return false;
+    }
+    if (!cache.commit(temp_path, *out_local_path)) {
+        add_metric(g_metrics.thumb_failures);
+        return false;
+    }
+    add_metric(g_metrics.thumb_generated);
+    return true;
+}
+
+// Native worker pool behind the iosb_submit_* exports. Operations wait in two
+// queues; interactive ones (list, stat) are picked first and bulk ones (pull,
+// push, thumbnail) may occupy all workers but one, so browsing never queues
+// behind a wall of transfers or previews. Completions go to the registered callback, or to a
+// queue drained by iosb_poll_completions. List results stay in their arena
+// until iosb_take_list_result copies them out.
+// Worker pool behind the iosb_submit_* calls. The engine is stopped until
+// the first start, running while it has workers, and stopping while a
+// shutdown joins them; start and submit fail while it is stopping, so a
+// shutdown never races a new pool or strands queued work.
+class AsyncEngine {
+public:
+    bool start(int worker_count) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (state_ == State::running) {
+            return true;
+        }
+        if (state_ == State::stopping) {
+            set_error("Async engine is shutting down.");
+            return false;
+        }
+        bool started = true;
+        try {
+            for (int i = 0; i < worker_count; ++i) {
+                workers_.emplace_back([this] { worker_loop(); });
+            }
+        } catch (const std::system_error&) {
+            set_error("Failed to start async worker threads.");
+            started = false;
+        }
+        // Workers that did start are kept so shutdown can join them.
+        worker_count_ = static_cast<int>(workers_.size());
+        state_ = workers_.empty() ? State::stopped : State::running;
+        return started;
+    }
+
+    // Stops the workers, cancels queued operations, drops list results that
+    // were never taken and wakes iosb_poll_completions waiters. Fails on a
+    // worker thread (from a completion callback), which would otherwise have
+    // to join itself, and while another shutdown is in progress.
+    bool shutdown() {
+        if (t_async_worker) {
+            set_error("iosb_async_shutdown cannot be called from a completion callback.");
+            return false;
+        }
+
+        std::vector<std::thread> workers;
+        std::deque<Operation> cancelled;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (state_ == State::stopping) {
+                set_error("Async engine is already shutting down.");
+                return false;
+            }
+            state_ = State::stopping;
+            ++shutdowns_;
+            workers.swap(workers_);
+            for (auto& queue : queues_) {
+                for (auto& op : queue) {
+                    cancelled.push_back(std::move(op));
+                }
+                queue.clear();
+            }
+        }
+        work_ready_.notify_all();
+        completion_ready_.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        std::unordered_map<int64_t, std::unique_ptr<DirectoryListing>> abandoned;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            abandoned.swap(listings_);
+        }
+        abandoned.clear();
+
+        for (const auto& op : cancelled) {
+            iosb_completion completion = make_completion(op);
+            copy_text(completion.error, IOSB_MAX_ERROR, "Operation cancelled by iosb_async_shutdown.");
+            deliver(completion);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        state_ = State::stopped;
+        return true;
+    }
+
+    void set_callback(iosb_completion_callback callback, void* user_data) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            callback_ = callback;
+            callback_user_data_ = user_data;
+        }
+        // Pollers stop waiting once completions go to the callback.
+        completion_ready_.notify_all();
+    }
+
+    bool submit(int op_kind, int handle, std::function<bool(DeviceSession&, iosb_completion&)> work, int64_t* out_op_id) {
+        if (out_op_id == nullptr) {
+            set_error("out_op_id is null");
+            return false;
+        }
+        auto session = find_session(handle);
+        if (session == nullptr) {
+            return false;
+        }
+        if (!start(kDefaultAsyncWorkers)) {
+            return false;
+        }
+
+        int io_class = IOSB_IO_BULK;
+        if (op_kind == IOSB_OP_LIST || op_kind == IOSB_OP_STAT) {
+            io_class = IOSB_IO_INTERACTIVE;
+        } else if (op_kind == IOSB_OP_THUMBNAIL) {
+            io_class = IOSB_IO_PREVIEW;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (state_ != State::running) {
+                set_error("Async engine is shutting down.");
+                return false;
+            }
+            *out_op_id = next_op_id_++;
+            queues_[io_class].push_back(Operation{*out_op_id, op_kind, io_class, std::move(session), std::move(work)});
+        }
+        add_metric(g_metrics.async_submitted);
+        work_ready_.notify_one();
+        return true;
+    }
+
+    // Returns queued completions, waiting up to timeout_ms for the first.
+    // Fails while a callback is set, since completions then never queue; a
+    // wait also ends early on shutdown or when a callback is installed.
+    int poll(iosb_completion* out, int max_completions, int timeout_ms) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (callback_ != nullptr) {
+            set_error("Completions go to the completion callback; clear it before polling.");
+            return -1;
+        }
+        if (timeout_ms != 0) {
+            const uint64_t shutdowns = shutdowns_;
+            const auto should_return = [&] {
+                return !completions_.empty() || callback_ != nullptr || shutdowns_ != shutdowns;
+            };
+            if (timeout_ms < 0) {
+                completion_ready_.wait(lock, should_return);
+            } else {
+                completion_ready_.wait_for(lock, std::chrono::milliseconds(timeout_ms), should_return);
+            }
+        }
+        int n = 0;
+        while (n < max_completions && !completions_.empty()) {
+            out[n++] = completions_.front();
+            completions_.pop_front();
+        }
+        return n;
+    }
+
+    void store_listing(int64_t op_id, std::unique_ptr<DirectoryListing> listing) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        listings_[op_id] = std::move(listing);
+    }
+
+    // Copies a finished listing out. A null out_entries only reports the
+    // count; otherwise the result is released after copying.
+    int take_listing(int64_t op_id, iosb_file_entry* out_entries, int max_entries) {
+        std::unique_ptr<DirectoryListing> listing;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            const auto it = listings_.find(op_id);
+            if (it == listings_.end()) {
+                set_error("No pending list result for this operation id");
+                return -1;
+            }
+            if (out_entries == nullptr) {
+                return static_cast<int>(it->second->size());
+            }
+            listing = std::move(it->second);
+            listings_.erase(it);
+        }
+
+        const int n = (std::min)(static_cast<int>(listing->size()), max_entries);
+        for (int i = 0; i < n; ++i) {
+            listing->write_entry(static_cast<size_t>(i), out_entries[i]);
+        }
+        return n;
+    }
+
+private:
+    enum class State { stopped, running, stopping };
+
+    struct Operation {
+        int64_t op_id;
+        int op_kind;
+        int io_class;
+        std::shared_ptr<DeviceSession> session;
+        std::function<bool(DeviceSession&, iosb_completion&)> work;
+    };
+
+    static iosb_completion make_completion(const Operation& op) {
+        iosb_completion completion;
+        std::memset(&completion, 0, sizeof(iosb_completion));
+        completion.op_id = op.op_id;
+        completion.op_kind = op.op_kind;
+        return completion;
+    }
+
+    // Previews and bulk transfers together leave one worker free for
+    // interactive work. Called with mutex_ held; null when nothing may run.
+    std::deque<Operation>* next_queue() {
+        if (!queues_[IOSB_IO_INTERACTIVE].empty()) {
+            return &queues_[IOSB_IO_INTERACTIVE];
+        }
+        if (active_background_ >= (std::max)(1, worker_count_ - 1)) {
+            return nullptr;
+        }
+        if (!queues_[IOSB_IO_PREVIEW].empty()) {
+            return &queues_[IOSB_IO_PREVIEW];
+        }
+        if (!queues_[IOSB_IO_BULK].empty()) {
+            return &queues_[IOSB_IO_BULK];
+        }
+        return nullptr;
+    }
+
+    void worker_loop() {
+        t_async_worker = true;
+        // Thumbnail operations decode through WIC on this thread.
+        const ComScope com;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            std::deque<Operation>* queue = nullptr;
+            work_ready_.wait(lock, [&] {
+                return state_ == State::stopping || (queue = next_queue()) != nullptr;
+            });
+            if (state_ == State::stopping) {
+                return;
+            }
+
+            Operation op = std::move(queue->front());
+            queue->pop_front();
+            const bool background = op.io_class != IOSB_IO_INTERACTIVE;
+            if (background) {
+                ++active_background_;
+            }
+            lock.unlock();
+
+            iosb_completion completion = make_completion(op);
+            g_last_error.clear();
+            if (op.op_kind == IOSB_OP_THUMBNAIL && !com.ok()) {
+                set_error("Failed to initialize COM for image decoding.");
+                completion.status = 0;
+            } else {
+                completion.status = op.work(*op.session, completion) ? 1 : 0;
+            }
+            if (completion.status == 0) {
+                copy_text(completion.error, IOSB_MAX_ERROR, g_last_error);
+            }
+            op.session.reset();
+            deliver(completion);
+
+            lock.lock();
+            if (background) {
+                --active_background_;
+                work_ready_.notify_one();
+            }
+        }
+    }
+
+    void deliver(const iosb_completion& completion) {
+        add_metric(g_metrics.async_completed);
+        iosb_completion_callback callback = nullptr;
+        void* user_data = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            callback = callback_;
+            user_data = callback_user_data_;
+            if (callback == nullptr) {
+                completions_.push_back(completion);
+            }
+        }
+        if (callback != nullptr) {
+            callback(&completion, user_data);
+        } else {
+            completion_ready_.notify_one();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable work_ready_;
+    std::condition_variable completion_ready_;
+    std::vector<std::thread> workers_;
+    std::deque<Operation> queues_[kIoClassCount];
+    std::deque<iosb_completion> completions_;
+    std::unordered_map<int64_t, std::unique_ptr<DirectoryListing>> listings_;
+    iosb_completion_callback callback_ = nullptr;
+    void* callback_user_data_ = nullptr;
+    int64_t next_op_id_ = 1;
+    int worker_count_ = 0;
+    int active_background_ = 0;
+    State state_ = State::stopped;
+    uint64_t shutdowns_ = 0;
+    static thread_local bool t_async_worker;
+};
+
+thread_local bool AsyncEngine::t_async_worker = false;
+
+AsyncEngine& async_engine() {
+    // Intentionally leaked: joining worker threads from a static destructor
+    // would deadlock under the loader lock at DLL unload.
+    static AsyncEngine* instance = new AsyncEngine();
+    return *instance;
+}
+
+}  // namespace
+
+extern "C" {
+
+int iosb_get_version(char* buffer, int buffer_size) {
+    if (!copy_text(buffer, buffer_size, kBackendVersion)) {
+        set_error("Version buffer too small");
+        return 0;
+    }
+    return 1;
+}
+
+int iosb_get_last_error(char* buffer, int buffer_size) {
+    if (!copy_text(buffer, buffer_size, g_last_error)) {
+        return 0;
+    }
+    return 1;
+}
+
+int iosb_get_runtime_diagnostics(char* buffer, int buffer_size) {
+    const std::string details = api().diagnostics();
+    if (!copy_text(buffer, buffer_size, details)) {
+        set_error("Diagnostics buffer too small");
+        return 0;
+    }
+    return 1;
+}
+
+int iosb_get_metrics(char* buffer, int buffer_size) {
+    if (!copy_text(buffer, buffer_size, build_metrics_report())) {
+        set_error("Metrics buffer too small");
         return 0;
     }
     return 1;
@@ -665,8 +2762,8 @@ int iosb_open_device(const char* udid, int* out_handle) {
         a.idevice_device_list_free(device_udids);
     }
 
-    DeviceSession session;
-    if (!create_afc_session(wanted.c_str(), session)) {
+    auto session = std::make_shared<DeviceSession>();
+    if (!create_afc_session(wanted.c_str(), *session)) {
         return 0;
     }
 
@@ -678,15 +2775,23 @@ int iosb_open_device(const char* udid, int* out_handle) {
 }
 
 int iosb_close_device(int handle) {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    auto it = g_open_handles.find(handle);
-    if (it == g_open_handles.end()) {
-        set_error("Invalid device handle");
-        return 0;
+    std::shared_ptr<DeviceSession> session;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        auto it = g_open_handles.find(handle);
+        if (it == g_open_handles.end()) {
+            set_error("Invalid device handle");
+            return 0;
+        }
+        session = std::move(it->second);
+        g_open_handles.erase(it);
     }
 
-    close_session(it->second);
-    g_open_handles.erase(it);
+    // In-flight operations see `closed` at their next request and release
+    // the shared lock, so this waits for at most one chunk per operation.
+    session->closed = true;
+    std::unique_lock<std::shared_mutex> lock(session->lock);
+    close_session(*session);
     return 1;
 }
 
@@ -696,58 +2801,55 @@ int iosb_list_directory(int handle, const char* path, iosb_file_entry* out_entri
         return -1;
     }
 
-    afc_client_t afc = nullptr;
-    {
-        std::lock_guard<std::mutex> lock(g_mutex);
-        const auto it = g_open_handles.find(handle);
-        if (it == g_open_handles.end()) {
-            set_error("Invalid or closed device handle");
-            return -1;
-        }
-        afc = it->second.afc;
+    const auto session = find_session(handle);
+    if (session == nullptr) {
+        return -1;
     }
 
-    const std::string remote_path = normalize_path(path);
-    bool ok = false;
-    auto entries = list_entries(afc, remote_path, &ok);
-    if (!ok) {
+    // Entries past max_entries are never returned, so they are not stat'd.
+    const bool count_only = out_entries == nullptr;
+    const size_t limit = count_only ? SIZE_MAX : static_cast<size_t>(max_entries);
+    const auto listing = list_directory(*session, normalize_path(path), limit, !count_only);
+    if (listing == nullptr) {
         return -1;
     }
 
-    if (out_entries == nullptr) {
-        return static_cast<int>(entries.size());
+    const int n = static_cast<int>(listing->size());
+    if (count_only) {
+        return n;
     }
-
-    const int n = (std::min)(static_cast<int>(entries.size()), max_entries);
     for (int i = 0; i < n; ++i) {
-        std::memset(&out_entries[i], 0, sizeof(iosb_file_entry));
-        copy_text(out_entries[i].path, IOSB_MAX_PATH, entries[i].path);
-        copy_text(out_entries[i].name, IOSB_MAX_NAME, entries[i].name);
-        out_entries[i].is_directory = entries[i].is_directory ? 1 : 0;
-        out_entries[i].size_bytes = entries[i].size_bytes;
-        out_entries[i].modified_unix = entries[i].modified_unix;
+        listing->write_entry(static_cast<size_t>(i), out_entries[i]);
     }
     return n;
 }
 
+int iosb_stat(int handle, const char* path, iosb_file_entry* out_entry) {
+    if (out_entry == nullptr) {
+        set_error("out_entry is null");
+        return 0;
+    }
+
+    const auto session = find_session(handle);
+    if (session == nullptr) {
+        return 0;
+    }
+
+    return stat_remote_path(*session, normalize_path(path), IOSB_IO_INTERACTIVE, *out_entry) ? 1 : 0;
+}
+
 int iosb_pull_file(int handle, const char* remote_path, const char* local_path) {
     if (remote_path == nullptr || local_path == nullptr) {
         set_error("remote_path/local_path cannot be null");
         return 0;
     }
 
-    afc_client_t afc = nullptr;
-    {
-        std::lock_guard<std::mutex> lock(g_mutex);
-        const auto it = g_open_handles.find(handle);
-        if (it == g_open_handles.end()) {
-            set_error("Invalid or closed device handle");
-            return 0;
-        }
-        afc = it->second.afc;
+    const auto session = find_session(handle);
+    if (session == nullptr) {
+        return 0;
     }
 
-    return read_remote_file_to_local(afc, normalize_path(remote_path).c_str(), local_path) ? 1 : 0;
+    return read_remote_file_to_local(*session, normalize_path(remote_path).c_str(), local_path) ? 1 : 0;
 }
 
 int iosb_push_file(int handle, const char* local_path, const char* remote_path) {
@@ -756,18 +2858,196 @@ int iosb_push_file(int handle, const char* local_path, const char* remote_path)
         return 0;
     }
 
-    afc_client_t afc = nullptr;
-    {
-        std::lock_guard<std::mutex> lock(g_mutex);
-        const auto it = g_open_handles.find(handle);
-        if (it == g_open_handles.end()) {
-            set_error("Invalid or closed device handle");
-            return 0;
+    const auto session = find_session(handle);
+    if (session == nullptr) {
+        return 0;
+    }
+
+    return push_local_file(*session, local_path, normalize_path(remote_path)) ? 1 : 0;
+}
+
+int iosb_pull_files(int handle, iosb_pull_item* items, int count) {
+    if (items == nullptr || count < 0) {
+        set_error("items cannot be null and count must be >= 0");
+        return -1;
+    }
+
+    const auto session = find_session(handle);
+    if (session == nullptr) {
+        return -1;
+    }
+
+    BatchedLocalWriter writer;
+    for (int i = 0; i < count; ++i) {
+        iosb_pull_item& item = items[i];
+        item.result = 0;
+        const std::string remote_path = normalize_path(item.remote_path);
+        if (item.size_bytes > 0 && item.size_bytes <= kSmallFileThreshold) {
+            // The writer may still clear result if the deferred local write fails.
+            item.result = 1;
+            bool size_changed = false;
+            const bool ok = run_with_retry(*session, [&](afc_client_t afc, SessionIo& io) {
+                return read_small_remote_file(afc, io, remote_path.c_str(), item.size_bytes, writer, item.local_path, &item.result, &size_changed);
+            });
+            if (!ok) {
+                item.result = size_changed && read_remote_file_to_local(*session, remote_path.c_str(), item.local_path) ? 1 : 0;
+            }
+        } else {
+            item.result = read_remote_file_to_local(*session, remote_path.c_str(), item.local_path) ? 1 : 0;
+        }
+    }
+    writer.flush();
+
+    int pulled = 0;
+    for (int i = 0; i < count; ++i) {
+        pulled += items[i].result;
+    }
+    return pulled;
+}
+
+int iosb_set_bandwidth_limit(int handle, int io_class, uint64_t bytes_per_second) {
+    // Interactive requests are small and latency-bound; capping them would
+    // only slow browsing, so only the bulk class can be limited.
+    if (io_class != IOSB_IO_BULK) {
+        set_error("Only IOSB_IO_BULK can be bandwidth limited");
+        return 0;
+    }
+
+    const auto session = find_session(handle);
+    if (session == nullptr) {
+        return 0;
+    }
+
+    session->io.set_bulk_bandwidth_limit(bytes_per_second);
+    return 1;
+}
+
+int iosb_async_start(int worker_count) {
+    if (worker_count <= 0 || worker_count > kMaxAsyncWorkers) {
+        set_error("worker_count must be between 1 and 64");
+        return 0;
+    }
+    return async_engine().start(worker_count) ? 1 : 0;
+}
+
+int iosb_async_shutdown(void) {
+    return async_engine().shutdown() ? 1 : 0;
+}
+
+int iosb_set_completion_callback(iosb_completion_callback callback, void* user_data) {
+    async_engine().set_callback(callback, user_data);
+    return 1;
+}
+
+int iosb_poll_completions(iosb_completion* out_completions, int max_completions, int timeout_ms) {
+    if (out_completions == nullptr || max_completions <= 0) {
+        set_error("out_completions cannot be null and max_completions must be > 0");
+        return -1;
+    }
+    return async_engine().poll(out_completions, max_completions, timeout_ms);
+}
+
+int iosb_submit_list_directory(int handle, const char* path, int64_t* out_op_id) {
+    const std::string remote_path = normalize_path(path);
+    auto& engine = async_engine();
+    return engine.submit(IOSB_OP_LIST, handle, [remote_path, &engine](DeviceSession& session, iosb_completion& completion) {
+        auto listing = list_directory(session, remote_path, SIZE_MAX, true);
+        if (listing == nullptr) {
+            return false;
         }
-        afc = it->second.afc;
+        completion.result_count = static_cast<int>(listing->size());
+        engine.store_listing(completion.op_id, std::move(listing));
+        return true;
+    }, out_op_id) ? 1 : 0;
+}
+
+int iosb_take_list_result(int64_t op_id, iosb_file_entry* out_entries, int max_entries) {
+    if (max_entries < 0) {
+        set_error("max_entries must be >= 0");
+        return -1;
+    }
+    return async_engine().take_listing(op_id, out_entries, max_entries);
+}
+
+int iosb_submit_stat(int handle, const char* path, int64_t* out_op_id) {
+    const std::string remote_path = normalize_path(path);
+    return async_engine().submit(IOSB_OP_STAT, handle, [remote_path](DeviceSession& session, iosb_completion& completion) {
+        return stat_remote_path(session, remote_path, IOSB_IO_INTERACTIVE, completion.entry);
+    }, out_op_id) ? 1 : 0;
+}
+
+int iosb_submit_pull(int handle, const char* remote_path, const char* local_path, int64_t* out_op_id) {
+    if (remote_path == nullptr || local_path == nullptr) {
+        set_error("remote_path/local_path cannot be null");
+        return 0;
     }
 
-    return write_local_file_to_remote(afc, local_path, normalize_path(remote_path).c_str()) ? 1 : 0;
+    const std::string remote = normalize_path(remote_path);
+    const std::string local = local_path;
+    return async_engine().submit(IOSB_OP_PULL, handle, [remote, local](DeviceSession& session, iosb_completion&) {
+        return read_remote_file_to_local(session, remote.c_str(), local.c_str());
+    }, out_op_id) ? 1 : 0;
+}
+
+int iosb_submit_push(int handle, const char* local_path, const char* remote_path, int64_t* out_op_id) {
+    if (local_path == nullptr || remote_path == nullptr) {
+        set_error("local_path/remote_path cannot be null");
+        return 0;
+    }
+
+    const std::string local = local_path;
+    const std::string remote = normalize_path(remote_path);
+    return async_engine().submit(IOSB_OP_PUSH, handle, [local, remote](DeviceSession& session, iosb_completion&) {
+        return push_local_file(session, local.c_str(), remote);
+    }, out_op_id) ? 1 : 0;
+}
+
+int iosb_set_thumbnail_cache(const char* directory, uint64_t max_bytes) {
+    return thumbnail_cache().configure(directory, max_bytes) ? 1 : 0;
+}
+
+int iosb_get_thumbnail(int handle, const char* remote_path, int max_edge, char* out_local_path, int out_local_path_size) {
+    if (remote_path == nullptr || out_local_path == nullptr) {
+        set_error("remote_path/out_local_path cannot be null");
+        return 0;
+    }
+
+    const auto session = find_session(handle);
+    if (session == nullptr) {
+        return 0;
+    }
+
+    const ComScope com;
+    if (!com.ok()) {
+        set_error("Failed to initialize COM for image decoding.");
+        return 0;
+    }
+    std::string local_path;
+    if (!generate_thumbnail(*session, normalize_path(remote_path), max_edge, &local_path)) {
+        return 0;
+    }
+    if (!copy_text(out_local_path, out_local_path_size, local_path)) {
+        set_error("Thumbnail path buffer too small");
+        return 0;
+    }
+    return 1;
+}
+
+int iosb_submit_thumbnail(int handle, const char* remote_path, int max_edge, int64_t* out_op_id) {
+    if (remote_path == nullptr) {
+        set_error("remote_path cannot be null");
+        return 0;
+    }
+
+    const std::string remote = normalize_path(remote_path);
+    return async_engine().submit(IOSB_OP_THUMBNAIL, handle, [remote, max_edge](DeviceSession& session, iosb_completion& completion) {
+        std::string local_path;
+        if (!generate_thumbnail(session, remote, max_edge, &local_path)) {
+            return false;
+        }
+        copy_text(completion.local_path, IOSB_MAX_PATH, local_path);
+        return true;
+    }, out_op_id) ? 1 : 0;
 }
 
 }  // extern "C"
@@ -16,6 +16,22 @@ extern "C" {
 #define IOSB_MAX_NAME 128
 #define IOSB_MAX_PATH 512
 
+/* I/O priority classes for per-device scheduling, highest first. Preview
+   covers thumbnail reads: they run ahead of bulk transfers and are not
+   subject to the bulk bandwidth cap. */
+#define IOSB_IO_INTERACTIVE 0
+#define IOSB_IO_BULK 1
+#define IOSB_IO_PREVIEW 2
+
+#define IOSB_MAX_ERROR 256
+
+/* Operation kinds reported in iosb_completion. */
+#define IOSB_OP_LIST 1
+#define IOSB_OP_STAT 2
+#define IOSB_OP_PULL 3
+#define IOSB_OP_PUSH 4
+#define IOSB_OP_THUMBNAIL 5
+
 typedef struct iosb_device_info {
     char udid[IOSB_MAX_UDID];
     char name[IOSB_MAX_NAME];
@@ -29,23 +45,97 @@ typedef struct iosb_file_entry {
     int64_t modified_unix;
 } iosb_file_entry;
 
+/* One file of a batched pull. size_bytes is the remote size from a previous
+   listing (0 = unknown); result is set to 1 on success, 0 on failure. */
+typedef struct iosb_pull_item {
+    char remote_path[IOSB_MAX_PATH];
+    char local_path[IOSB_MAX_PATH];
+    uint64_t size_bytes;
+    int result;
+} iosb_pull_item;
+
+/* Result of an asynchronous operation. status is 1 on success, 0 on failure
+   (error then holds the message). For IOSB_OP_LIST, result_count entries are
+   waiting in iosb_take_list_result; for IOSB_OP_STAT, entry holds the result;
+   for IOSB_OP_THUMBNAIL, local_path names the cached thumbnail file. */
+typedef struct iosb_completion {
+    int64_t op_id;
+    int op_kind;
+    int status;
+    int result_count;
+    iosb_file_entry entry;
+    char local_path[IOSB_MAX_PATH];
+    char error[IOSB_MAX_ERROR];
+} iosb_completion;
+
+/* Invoked on a native worker thread; the completion is only valid during the call. */
+typedef void (*iosb_completion_callback)(const iosb_completion* completion, void* user_data);
+
 IOSB_API int iosb_get_version(char* buffer, int buffer_size);
 IOSB_API int iosb_get_last_error(char* buffer, int buffer_size);
 IOSB_API int iosb_get_runtime_diagnostics(char* buffer, int buffer_size);
+IOSB_API int iosb_get_metrics(char* buffer, int buffer_size);
 
 IOSB_API int iosb_enumerate_devices(iosb_device_info* out_devices, int max_devices);
 IOSB_API int iosb_open_device(const char* udid, int* out_handle);
 IOSB_API int iosb_close_device(int handle);
 
+/* Writes up to max_entries entries of a directory and returns the number
+   written; entries past max_entries are not stat'd. With out_entries NULL,
+   returns the entry count without stat'ing anything. */
 IOSB_API int iosb_list_directory(
     int handle,
     const char* path,
     iosb_file_entry* out_entries,
     int max_entries);
 
+IOSB_API int iosb_stat(int handle, const char* path, iosb_file_entry* out_entry);
+
 IOSB_API int iosb_pull_file(int handle, const char* remote_path, const char* local_path);
 IOSB_API int iosb_push_file(int handle, const char* local_path, const char* remote_path);
 
+/* Pulls several files over one AFC connection. Returns the number of items
+   pulled successfully, or -1 on invalid arguments. */
+IOSB_API int iosb_pull_files(int handle, iosb_pull_item* items, int count);
+
+/* Caps the byte rate of IOSB_IO_BULK traffic (pulls and pushes) on a
+   device; 0 removes the cap. Other classes are rejected. */
+IOSB_API int iosb_set_bandwidth_limit(int handle, int io_class, uint64_t bytes_per_second);
+
+/* Asynchronous API. Submit calls return 1 and an operation id immediately;
+   the work runs on a native worker pool (started on first submit with 4
+   workers, or explicitly via iosb_async_start). Completions are passed to
+   the callback when one is set, otherwise queued for iosb_poll_completions
+   (timeout_ms: 0 = don't wait, < 0 = wait indefinitely). Polling fails
+   with -1 while a callback is set; a waiting poll returns early when a
+   callback is installed or the engine shuts down.
+   iosb_async_shutdown cancels queued operations, discards list results not
+   yet taken and wakes waiting polls; it fails when called from a completion
+   callback or while another shutdown runs. Submits and iosb_async_start
+   fail while a shutdown is in progress. */
+IOSB_API int iosb_async_start(int worker_count);
+IOSB_API int iosb_async_shutdown(void);
+IOSB_API int iosb_set_completion_callback(iosb_completion_callback callback, void* user_data);
+IOSB_API int iosb_poll_completions(iosb_completion* out_completions, int max_completions, int timeout_ms);
+
+IOSB_API int iosb_submit_list_directory(int handle, const char* path, int64_t* out_op_id);
+IOSB_API int iosb_submit_stat(int handle, const char* path, int64_t* out_op_id);
+IOSB_API int iosb_submit_pull(int handle, const char* remote_path, const char* local_path, int64_t* out_op_id);
+IOSB_API int iosb_submit_push(int handle, const char* local_path, const char* remote_path, int64_t* out_op_id);
+
+/* Copies the entries of a completed IOSB_OP_LIST. With out_entries == NULL
+   returns the count and keeps the result; otherwise copies up to max_entries
+   and releases it. */
+IOSB_API int iosb_take_list_result(int64_t op_id, iosb_file_entry* out_entries, int max_entries);
+
+/* Thumbnails are generated from embedded previews (JPEG EXIF, HEIC, MOV/MP4
+   cover art, else the first video frame) using ranged reads, scaled to fit
+   max_edge (0 = 256, max 1024) and stored as JPEG in a bounded on-disk cache
+   that must be configured first; max_bytes must be non-zero. */
+IOSB_API int iosb_set_thumbnail_cache(const char* directory, uint64_t max_bytes);
+IOSB_API int iosb_get_thumbnail(int handle, const char* remote_path, int max_edge, char* out_local_path, int out_local_path_size);
+IOSB_API int iosb_submit_thumbnail(int handle, const char* remote_path, int max_edge, int64_t* out_op_id);
+
 #ifdef __cplusplus
 }
 #endif
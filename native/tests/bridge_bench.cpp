@@ -0,0 +1,212 @@
+// Benchmarks for the native bridge against the fake libimobiledevice runtime,
+// with a simulated USB round-trip time on every AFC request.
+//
+// Usage: bridge_bench [rtt_us]   (default 1000)
+#include "../ios_device_bridge.cpp"
+
+#include "test_support.h"
+
+#include <new>
+
+using namespace test_support;
+
+// Counts heap allocations so the listing benchmark can show what the arena
+// saves. The fake runtime's own allocations are the same for every variant.
+std::atomic<uint64_t> g_heap_allocations{0};
+
+void* operator new(size_t size) {
+    g_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+constexpr int kDefaultRttUs = 1000;
+constexpr int kPullFileCount = 200;
+constexpr int kListingFileCount = 5000;
+constexpr int kListingRepeats = 10;
+constexpr int kListingPageSize = 100;
+
+struct BenchResult {
+    double ms = 0;
+    uint64_t round_trips = 0;
+    uint64_t heap_allocations = 0;
+};
+
+void print_result(const char* name, const BenchResult& result, int items) {
+    std::printf(
+        "  %-28s %9.1f ms  %6llu round trips  %7.3f ms/item\n",
+        name,
+        result.ms,
+        static_cast<unsigned long long>(result.round_trips),
+        result.ms / items);
+}
+
+template <typename Fn>
+BenchResult measure(Fn&& fn) {
+    const uint64_t round_trips = fake_afc_round_trips();
+    const uint64_t allocations = g_heap_allocations.load();
+    const auto started = std::chrono::steady_clock::now();
+    fn();
+    return BenchResult{elapsed_ms(started), fake_afc_round_trips() - round_trips, g_heap_allocations.load() - allocations};
+}
+
+// The listing as it was before the arena: two std::strings per entry, a full
+// path built per stat, and every entry stat'd whatever the caller asked for.
+struct BaselineEntry {
+    std::string path;
+    std::string name;
+    bool is_directory = false;
+    uint64_t size_bytes = 0;
+    int64_t modified_unix = 0;
+};
+
+int baseline_list_directory(afc_client_t afc, const std::string& path, iosb_file_entry* out_entries, int max_entries) {
+    auto& a = api();
+    char** names = nullptr;
+    if (a.afc_read_directory(afc, path.c_str(), &names) != 0 || names == nullptr) {
+        return -1;
+    }
+
+    std::vector<BaselineEntry> entries;
+    for (int i = 0; names[i] != nullptr; ++i) {
+        const std::string name = names[i];
+        if (name == "." || name == "..") {
+            continue;
+        }
+        BaselineEntry entry;
+        entry.name = name;
+        entry.path = path + "/" + name;
+        entry.modified_unix = now_unix();
+        char** info = nullptr;
+        if (a.afc_get_file_info(afc, entry.path.c_str(), &info) == 0 && info != nullptr) {
+            entry.is_directory = dict_is_directory(info);
+            entry.size_bytes = parse_u64(dict_value(info, "st_size"), 0);
+            entry.modified_unix = parse_i64(dict_value(info, "st_mtime"), entry.modified_unix);
+            a.afc_dictionary_free(info);
+        }
+        entries.push_back(std::move(entry));
+    }
+    a.afc_dictionary_free(names);
+
+    const int n = (std::min)(static_cast<int>(entries.size()), max_entries);
+    for (int i = 0; i < n; ++i) {
+        std::memset(&out_entries[i], 0, sizeof(iosb_file_entry));
+        copy_text(out_entries[i].path, IOSB_MAX_PATH, entries[i].path);
+        copy_text(out_entries[i].name, IOSB_MAX_NAME, entries[i].name);
+        out_entries[i].is_directory = entries[i].is_directory ? 1 : 0;
+        out_entries[i].size_bytes = entries[i].size_bytes;
+        out_entries[i].modified_unix = entries[i].modified_unix;
+    }
+    return n;
+}
+
+void print_listing_result(const char* name, const BenchResult& result) {
+    std::printf(
+        "  %-28s %9.2f ms  %6llu round trips  %7llu heap allocations\n",
+        name,
+        result.ms / kListingRepeats,
+        static_cast<unsigned long long>(result.round_trips / kListingRepeats),
+        static_cast<unsigned long long>(result.heap_allocations / kListingRepeats));
+}
+
+// A camera-roll sized directory with names too long for the small-string
+// buffer, listed without round-trip delay so the bridge's own cost shows.
+void bench_listing(int handle) {
+    const std::string directory = "/DCIM/101APPLE";
+    fake_afc_add_directory(directory.c_str());
+    for (int i = 0; i < kListingFileCount; ++i) {
+        add_remote_file(directory + "/IMG_E" + std::to_string(100000 + i) + "_EDITED_VERSION.HEIC", "x");
+    }
+
+    const auto session = find_session(handle);
+    std::vector<iosb_file_entry> entries(kListingFileCount);
+
+    const BenchResult baseline = measure([&] {
+        for (int i = 0; i < kListingRepeats; ++i) {
+            baseline_list_directory(session->afc, directory, entries.data(), kListingFileCount);
+        }
+    });
+    const BenchResult arena = measure([&] {
+        for (int i = 0; i < kListingRepeats; ++i) {
+            iosb_list_directory(handle, directory.c_str(), entries.data(), kListingFileCount);
+        }
+    });
+    const BenchResult baseline_page = measure([&] {
+        for (int i = 0; i < kListingRepeats; ++i) {
+            baseline_list_directory(session->afc, directory, entries.data(), kListingPageSize);
+        }
+    });
+    const BenchResult arena_page = measure([&] {
+        for (int i = 0; i < kListingRepeats; ++i) {
+            iosb_list_directory(handle, directory.c_str(), entries.data(), kListingPageSize);
+        }
+    });
+
+    std::printf("List %d entries, no round-trip delay (per listing):\n", kListingFileCount);
+    print_listing_result("baseline, all entries", baseline);
+    print_listing_result("arena, all entries", arena);
+    print_listing_result("baseline, first 100", baseline_page);
+    print_listing_result("arena, first 100", arena_page);
+}
+
+// Many small photos, as when exporting a camera roll: the per-file request
+// count dominates, not the byte count.
+void bench_small_file_pulls(int handle) {
+    std::vector<iosb_pull_item> items(kPullFileCount);
+    for (int i = 0; i < kPullFileCount; ++i) {
+        const std::string remote = "/DCIM/100APPLE/IMG_" + std::to_string(1000 + i) + ".JPG";
+        const std::string data = pattern(4096 + (i % 16) * 2048, i);
+        add_remote_file(remote, data);
+        iosb_pull_item& item = items[i];
+        std::memset(&item, 0, sizeof(item));
+        std::snprintf(item.remote_path, IOSB_MAX_PATH, "%s", remote.c_str());
+        std::snprintf(item.local_path, IOSB_MAX_PATH, "%s", local_path("bench_" + std::to_string(i)).c_str());
+        item.size_bytes = data.size();
+    }
+
+    const BenchResult sequential = measure([&] {
+        for (const iosb_pull_item& item : items) {
+            iosb_pull_file(handle, item.remote_path, item.local_path);
+        }
+    });
+    const BenchResult batched = measure([&] { iosb_pull_files(handle, items.data(), kPullFileCount); });
+
+    std::printf("Pull %d small files (4-34 KB):\n", kPullFileCount);
+    print_result("iosb_pull_file loop", sequential, kPullFileCount);
+    print_result("iosb_pull_files", batched, kPullFileCount);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const int rtt_us = argc > 1 ? std::atoi(argv[1]) : kDefaultRttUs;
+    prepare_output_dir();
+    fake_afc_reset();
+    fake_afc_set_rtt_us(rtt_us);
+    std::printf("Simulated round-trip time: %d us\n", rtt_us);
+
+    const int handle = open_fake_device();
+    if (handle == 0) {
+        std::printf("Failed to open the fake device: %s\n", last_error().c_str());
+        return 1;
+    }
+
+    bench_small_file_pulls(handle);
+    fake_afc_set_rtt_us(0);
+    bench_listing(handle);
+
+    iosb_close_device(handle);
+    return 0;
+}
@@ -0,0 +1,866 @@
+// Tests for the native bridge. The bridge source is compiled into this
+// executable so internal helpers can be tested directly; device traffic goes
+// to the fake libimobiledevice runtime built from fake_afc.cpp.
+#include "../ios_device_bridge.cpp"
+
+#include "test_support.h"
+
+#include <future>
+
+using namespace test_support;
+
+namespace {
+
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+std::vector<TestCase>& test_cases() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+bool register_test(const char* name, void (*run)()) {
+    test_cases().push_back(TestCase{name, run});
+    return true;
+}
+
+bool g_test_failed = false;
+
+}  // namespace
+
+#define TEST(name)                                                   \
+    static void name();                                              \
+    static const bool name##_registered = register_test(#name, name); \
+    static void name()
+
+#define CHECK(cond)                                                                    \
+    do {                                                                               \
+        if (!(cond)) {                                                                 \
+            std::printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);     \
+            std::printf("  last error: %s\n", last_error().c_str());                   \
+            g_test_failed = true;                                                      \
+            return;                                                                    \
+        }                                                                              \
+    } while (0)
+
+// --- Runtime loader ---
+
+TEST(diagnostics_do_not_load_runtime) {
+    LibIdeviceApi loader;
+    const std::string report = loader.diagnostics();
+    CHECK(report.find("LOAD OK") != std::string::npos);
+    CHECK(!loader.loaded());
+    CHECK(loader.ensure_loaded());
+    CHECK(loader.loaded());
+    CHECK(loader.diagnostics().find("LOAD OK") != std::string::npos);
+}
+
+TEST(runtime_binds_write_and_seek_at_load) {
+    LibIdeviceApi loader;
+    CHECK(loader.ensure_loaded());
+    CHECK(loader.afc_file_write != nullptr);
+    CHECK(loader.afc_file_seek != nullptr);
+}
+
+// --- copy_joined ---
+
+TEST(copy_joined_joins_prefix_and_name) {
+    char out[16];
+    CHECK(copy_joined(out, sizeof(out), "/DCIM/", "a.jpg"));
+    CHECK(std::string(out) == "/DCIM/a.jpg");
+    CHECK(copy_joined(out, sizeof(out), std::string_view(), "name"));
+    CHECK(std::string(out) == "name");
+}
+
+TEST(copy_joined_fits_exactly) {
+    char out[8];
+    CHECK(copy_joined(out, sizeof(out), "/abc/", "de"));
+    CHECK(std::string(out) == "/abc/de");
+}
+
+TEST(copy_joined_truncates_and_reports) {
+    char out[8];
+    CHECK(!copy_joined(out, sizeof(out), "/abc/", "def"));
+    CHECK(std::string(out) == "/abc/de");
+    CHECK(!copy_joined(out, sizeof(out), "/a-long-prefix/", "x"));
+    CHECK(std::string(out) == "/a-long");
+    CHECK(!copy_joined(out, 0, "/", "x"));
+    CHECK(!copy_joined(nullptr, 8, "/", "x"));
+}
+
+// --- BatchedLocalWriter ---
+// The writer keeps the local path pointers until it flushes, so the paths
+// below outlive it.
+
+TEST(batched_writer_flushes_pending_files) {
+    const std::string first_path = local_path("writer_first");
+    const std::string second_path = local_path("writer_second");
+    std::remove(first_path.c_str());
+    int first = 1;
+    int second = 1;
+    {
+        BatchedLocalWriter writer;
+        char* target = writer.begin_file(16);
+        std::memcpy(target, "first", 5);
+        writer.commit_file(first_path.c_str(), 5, &first);
+        target = writer.begin_file(16);
+        std::memcpy(target, "second", 6);
+        writer.commit_file(second_path.c_str(), 6, &second);
+        // Nothing reaches the disk until the writer flushes.
+        CHECK(!local_exists(first_path));
+    }
+    CHECK(first == 1 && second == 1);
+    CHECK(read_local(first_path) == "first");
+    CHECK(read_local(second_path) == "second");
+}
+
+TEST(batched_writer_discard_drops_file) {
+    const std::string path = local_path("writer_kept");
+    int result = 1;
+    BatchedLocalWriter writer;
+    char* target = writer.begin_file(8);
+    std::memcpy(target, "gone", 4);
+    writer.discard_file();
+    target = writer.begin_file(8);
+    std::memcpy(target, "kept", 4);
+    writer.commit_file(path.c_str(), 4, &result);
+    writer.flush();
+    CHECK(read_local(path) == "kept");
+}
+
+TEST(batched_writer_flushes_when_full) {
+    const std::string big_path = local_path("writer_big");
+    const std::string tail_path = local_path("writer_tail");
+    const uint64_t flushes = g_metrics.batched_local_flushes.load();
+    const std::string big = pattern(kBatchWriterCapacity - 16, 1);
+    int first = 1;
+    int second = 1;
+    BatchedLocalWriter writer;
+    char* target = writer.begin_file(big.size());
+    std::memcpy(target, big.data(), big.size());
+    writer.commit_file(big_path.c_str(), big.size(), &first);
+    target = writer.begin_file(64);
+    CHECK(g_metrics.batched_local_flushes.load() == flushes + 1);
+    CHECK(read_local(big_path) == big);
+    std::memcpy(target, "tail", 4);
+    writer.commit_file(tail_path.c_str(), 4, &second);
+    writer.flush();
+    CHECK(read_local(tail_path) == "tail");
+}
+
+TEST(batched_writer_reports_local_write_failure) {
+    const std::string path = local_path("missing_dir/file");
+    int result = 1;
+    BatchedLocalWriter writer;
+    char* target = writer.begin_file(4);
+    std::memcpy(target, "data", 4);
+    writer.commit_file(path.c_str(), 4, &result);
+    writer.flush();
+    CHECK(result == 0);
+}
+
+// --- Pulls ---
+
+TEST(pull_file_copies_content) {
+    const std::string data = pattern(300 * 1024 + 17, 2);
+    add_remote_file("/large.bin", data);
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+    CHECK(iosb_pull_file(handle, "/large.bin", local_path("large.bin").c_str()) == 1);
+    CHECK(read_local(local_path("large.bin")) == data);
+    CHECK(fake_afc_open_handles() == 0);
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+TEST(pull_file_reports_missing_remote) {
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+    CHECK(iosb_pull_file(handle, "/missing.bin", local_path("missing.bin").c_str()) == 0);
+    CHECK(!last_error().empty());
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+TEST(pull_files_small_files_take_three_round_trips) {
+    constexpr int kCount = 40;
+    std::vector<iosb_pull_item> items(kCount);
+    std::vector<std::string> contents;
+    for (int i = 0; i < kCount; ++i) {
+        const std::string remote = "/DCIM/IMG_" + std::to_string(i) + ".JPG";
+        contents.push_back(pattern(100 + i * 513, i));
+        add_remote_file(remote, contents.back());
+        std::memset(&items[i], 0, sizeof(items[i]));
+        std::snprintf(items[i].remote_path, IOSB_MAX_PATH, "%s", remote.c_str());
+        std::snprintf(items[i].local_path, IOSB_MAX_PATH, "%s", local_path("small_" + std::to_string(i)).c_str());
+        items[i].size_bytes = contents.back().size();
+    }
+
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+    const uint64_t before = fake_afc_round_trips();
+    CHECK(iosb_pull_files(handle, items.data(), kCount) == kCount);
+    // open, one read of size + 1 bytes, close; no trailing zero-byte read.
+    CHECK(fake_afc_round_trips() - before == 3u * kCount);
+    for (int i = 0; i < kCount; ++i) {
+        CHECK(items[i].result == 1);
+        CHECK(read_local(items[i].local_path) == contents[i]);
+    }
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+TEST(pull_files_falls_back_when_size_changed) {
+    const std::string data = pattern(5000, 3);
+    add_remote_file("/changed.bin", data);
+    iosb_pull_item item = {};
+    std::snprintf(item.remote_path, IOSB_MAX_PATH, "/changed.bin");
+    std::snprintf(item.local_path, IOSB_MAX_PATH, "%s", local_path("changed.bin").c_str());
+    item.size_bytes = 4000;
+
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+    CHECK(iosb_pull_files(handle, &item, 1) == 1);
+    CHECK(item.result == 1);
+    CHECK(read_local(item.local_path) == data);
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+TEST(pull_files_reports_per_item_results) {
+    add_remote_file("/present.bin", pattern(64, 4));
+    iosb_pull_item items[2] = {};
+    std::snprintf(items[0].remote_path, IOSB_MAX_PATH, "/present.bin");
+    std::snprintf(items[0].local_path, IOSB_MAX_PATH, "%s", local_path("present.bin").c_str());
+    items[0].size_bytes = 64;
+    std::snprintf(items[1].remote_path, IOSB_MAX_PATH, "/absent.bin");
+    std::snprintf(items[1].local_path, IOSB_MAX_PATH, "%s", local_path("absent.bin").c_str());
+    items[1].size_bytes = 64;
+
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+    CHECK(iosb_pull_files(handle, items, 2) == 1);
+    CHECK(items[0].result == 1);
+    CHECK(items[1].result == 0);
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+TEST(push_file_copies_content) {
+    const std::string data = pattern(150 * 1024, 5);
+    write_local(local_path("push.bin"), data);
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+    CHECK(iosb_push_file(handle, local_path("push.bin").c_str(), "/pushed.bin") == 1);
+    CHECK(read_remote("/pushed.bin") == data);
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+// --- IoScheduler ---
+
+TEST(scheduler_runs_interactive_before_waiting_bulk) {
+    IoScheduler scheduler;
+    std::mutex order_mutex;
+    std::vector<char> order;
+    const auto record = [&](char c) {
+        std::lock_guard<std::mutex> lock(order_mutex);
+        order.push_back(c);
+        return 0;
+    };
+
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::promise<void> holding;
+    std::thread holder([&] {
+        scheduler.run(IOSB_IO_BULK, [&] {
+            holding.set_value();
+            released.wait();
+            return 0;
+        });
+    });
+    holding.get_future().wait();
+
+    std::thread bulk([&] { scheduler.run(IOSB_IO_BULK, [&] { return record('B'); }); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::thread interactive([&] { scheduler.run(IOSB_IO_INTERACTIVE, [&] { return record('I'); }); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    release.set_value();
+    holder.join();
+    bulk.join();
+    interactive.join();
+
+    CHECK(order.size() == 2);
+    CHECK(order[0] == 'I');
+    CHECK(order[1] == 'B');
+}
+
+TEST(scheduler_throttles_bulk_bytes) {
+    IoScheduler scheduler;
+    auto started = std::chrono::steady_clock::now();
+    scheduler.throttle(10 * 1024 * 1024);
+    CHECK(elapsed_ms(started) < 50);
+
+    scheduler.set_bulk_bandwidth_limit(1000000);
+    started = std::chrono::steady_clock::now();
+    for (int i = 0; i < 5; ++i) {
+        scheduler.throttle(50000);
+    }
+    const double ms = elapsed_ms(started);
+    CHECK(ms >= 245);
+    CHECK(ms < 1000);
+
+    scheduler.set_bulk_bandwidth_limit(0);
+    started = std::chrono::steady_clock::now();
+    scheduler.throttle(10 * 1024 * 1024);
+    CHECK(elapsed_ms(started) < 50);
+}
+
+TEST(listing_takes_one_turn_per_stat_batch) {
+    fake_afc_add_directory("/big");
+    for (int i = 0; i < 40; ++i) {
+        add_remote_file("/big/f" + std::to_string(i), "x");
+    }
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+    std::vector<iosb_file_entry> entries(40);
+    const uint64_t turns = g_metrics.io_interactive_turns.load();
+    CHECK(iosb_list_directory(handle, "/big", entries.data(), 40) == 40);
+    // One turn for the directory read, then one per batch of 16 stats.
+    CHECK(g_metrics.io_interactive_turns.load() - turns == 1 + 3);
+    CHECK(entries[39].size_bytes == 1);
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+TEST(bulk_transfer_proceeds_between_listing_batches) {
+    fake_afc_add_directory("/big");
+    for (int i = 0; i < 160; ++i) {
+        add_remote_file("/big/f" + std::to_string(i), "x");
+    }
+    add_remote_file("/large.bin", pattern(20 * kChunkSize, 9));
+    fake_afc_set_rtt_us(1000);
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+
+    std::atomic<bool> pull_done{false};
+    std::thread pull([&] {
+        iosb_pull_file(handle, "/large.bin", local_path("between.bin").c_str());
+        pull_done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    const uint64_t bulk_turns = g_metrics.io_bulk_turns.load();
+    std::vector<iosb_file_entry> entries(160);
+    CHECK(iosb_list_directory(handle, "/big", entries.data(), 160) == 160);
+    // The listing spans ten stat batches; the pull gets turns in between
+    // instead of waiting for all 160 stats.
+    const bool pull_progressed = pull_done || g_metrics.io_bulk_turns.load() > bulk_turns;
+    pull.join();
+    CHECK(pull_progressed);
+    CHECK(read_local(local_path("between.bin")) == read_remote("/large.bin"));
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+// Holds the scheduler with a bulk turn, lets `queue` start waiters (each
+// given time to block), then releases the turn.
+template <typename Queue>
+void run_while_held(IoScheduler& scheduler, Queue&& queue) {
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::promise<void> holding;
+    std::thread holder([&] {
+        scheduler.run(IOSB_IO_BULK, [&] {
+            holding.set_value();
+            released.wait();
+            return 0;
+        });
+    });
+    holding.get_future().wait();
+    queue();
+    release.set_value();
+    holder.join();
+}
+
+TEST(scheduler_runs_previews_between_interactive_and_bulk) {
+    IoScheduler scheduler;
+    std::mutex order_mutex;
+    std::string order;
+    const auto record = [&](char c) {
+        std::lock_guard<std::mutex> lock(order_mutex);
+        order.push_back(c);
+        return 0;
+    };
+
+    std::vector<std::thread> threads;
+    run_while_held(scheduler, [&] {
+        const std::pair<int, char> waiters[] = {{IOSB_IO_BULK, 'B'}, {IOSB_IO_PREVIEW, 'P'}, {IOSB_IO_INTERACTIVE, 'I'}};
+        for (const auto& waiter : waiters) {
+            threads.emplace_back([&, waiter] { scheduler.run(waiter.first, [&] { return record(waiter.second); }); });
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    });
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    CHECK(order == "IPB");
+}
+
+TEST(scheduler_gives_waiting_bulk_a_turn_between_previews) {
+    IoScheduler scheduler;
+    std::mutex order_mutex;
+    std::string order;
+    const auto record = [&](char c) {
+        std::lock_guard<std::mutex> lock(order_mutex);
+        order.push_back(c);
+        return 0;
+    };
+
+    std::vector<std::thread> threads;
+    run_while_held(scheduler, [&] {
+        threads.emplace_back([&] { scheduler.run(IOSB_IO_BULK, [&] { return record('B'); }); });
+        for (int i = 0; i < kPreviewTurnsPerBulkTurn + 2; ++i) {
+            threads.emplace_back([&] { scheduler.run(IOSB_IO_PREVIEW, [&] { return record('P'); }); });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    });
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    CHECK(order == std::string(kPreviewTurnsPerBulkTurn, 'P') + "BPP");
+}
+
+// --- Retries ---
+
+TEST(transient_errors_are_link_loss_codes) {
+    for (const int rc : {11, 12, 19, 20, 21, 30, 32}) {
+        CHECK(is_transient_afc_error(rc));
+    }
+    for (const int rc : {0, 1, 2, 4, 5, 7, 8, 10, 15}) {
+        CHECK(!is_transient_afc_error(rc));
+    }
+}
+
+TEST(retry_delay_backs_off_within_budget) {
+    CHECK(retry_delay_ms(0, 0) == kRetryBaseDelayMs);
+    CHECK(retry_delay_ms(1, 0) == kRetryBaseDelayMs * 2);
+    CHECK(retry_delay_ms(4, 0) == kRetryMaxDelayMs);
+    CHECK(retry_delay_ms(40, 0) == kRetryMaxDelayMs);
+    CHECK(retry_delay_ms(6, kRetryBudgetMs - kRetryMaxDelayMs) == kRetryMaxDelayMs);
+    CHECK(retry_delay_ms(6, kRetryBudgetMs - kRetryMaxDelayMs + 1) == -1);
+}
+
+TEST(pull_recovers_from_link_loss) {
+    const std::string data = pattern(200 * 1024, 6);
+    add_remote_file("/flaky.bin", data);
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+    const uint64_t retries = g_metrics.afc_retries.load();
+    // Let the open and two chunk reads through, then drop the link once.
+    fake_afc_inject_failures(3, kAfcMuxError, 1);
+    CHECK(iosb_pull_file(handle, "/flaky.bin", local_path("flaky.bin").c_str()) == 1);
+    CHECK(read_local(local_path("flaky.bin")) == data);
+    CHECK(g_metrics.afc_retries.load() == retries + 1);
+    CHECK(fake_afc_clients_created() == 2);
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+TEST(pull_does_not_retry_device_errors) {
+    add_remote_file("/bad.bin", pattern(1024, 7));
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+    const uint64_t retries = g_metrics.afc_retries.load();
+    fake_afc_inject_failures(1, kAfcReadError, 1);
+    CHECK(iosb_pull_file(handle, "/bad.bin", local_path("bad.bin").c_str()) == 0);
+    CHECK(g_metrics.afc_retries.load() == retries);
+    CHECK(fake_afc_clients_created() == 1);
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+TEST(failed_pull_keeps_existing_local_file) {
+    const std::string target = local_path("kept.bin");
+    write_local(target, "previous content");
+    add_remote_file("/broken.bin", pattern(100 * 1024, 8));
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+    CHECK(iosb_pull_file(handle, "/missing.bin", target.c_str()) == 0);
+    CHECK(read_local(target) == "previous content");
+    fake_afc_inject_failures(2, kAfcReadError, 1);
+    CHECK(iosb_pull_file(handle, "/broken.bin", target.c_str()) == 0);
+    CHECK(read_local(target) == "previous content");
+    CHECK(!local_exists(target + ".part"));
+    CHECK(iosb_pull_file(handle, "/broken.bin", target.c_str()) == 1);
+    CHECK(read_local(target) == read_remote("/broken.bin"));
+    CHECK(!local_exists(target + ".part"));
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+// --- Listing ---
+
+void add_listing_fixture(int files) {
+    fake_afc_add_directory("/DCIM");
+    fake_afc_add_directory("/DCIM/100APPLE");
+    for (int i = 0; i < files; ++i) {
+        add_remote_file("/DCIM/IMG_" + std::to_string(1000 + i) + ".JPG", pattern(10 + i, i));
+    }
+}
+
+TEST(list_directory_returns_entries) {
+    add_listing_fixture(3);
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+    iosb_file_entry entries[8] = {};
+    CHECK(iosb_list_directory(handle, "/DCIM", entries, 8) == 4);
+    CHECK(std::string(entries[0].name) == "100APPLE");
+    CHECK(std::string(entries[0].path) == "/DCIM/100APPLE");
+    CHECK(entries[0].is_directory == 1);
+    CHECK(std::string(entries[1].path) == "/DCIM/IMG_1000.JPG");
+    CHECK(entries[1].is_directory == 0);
+    CHECK(entries[1].size_bytes == 10);
+    CHECK(entries[3].size_bytes == 12);
+    CHECK(entries[3].modified_unix == 1700000000);
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+TEST(list_directory_stats_only_returned_entries) {
+    add_listing_fixture(50);
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+    iosb_file_entry entries[5] = {};
+    uint64_t before = fake_afc_round_trips();
+    CHECK(iosb_list_directory(handle, "/DCIM", entries, 5) == 5);
+    // One read_directory plus one stat per returned entry.
+    CHECK(fake_afc_round_trips() - before == 6);
+    CHECK(std::string(entries[4].name) == "IMG_1003.JPG");
+
+    before = fake_afc_round_trips();
+    CHECK(iosb_list_directory(handle, "/DCIM", nullptr, 0) == 51);
+    CHECK(fake_afc_round_trips() - before == 1);
+
+    before = fake_afc_round_trips();
+    CHECK(iosb_list_directory(handle, "/DCIM", entries, 0) == 0);
+    CHECK(fake_afc_round_trips() - before == 1);
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+TEST(list_directory_reports_missing_directory) {
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+    CHECK(iosb_list_directory(handle, "/missing", nullptr, 0) == -1);
+    CHECK(!last_error().empty());
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+// --- Thumbnails ---
+
+void append_u16(std::string& out, uint16_t value, bool le) {
+    const char bytes[2] = {static_cast<char>(value >> 8), static_cast<char>(value)};
+    out += le ? std::string{bytes[1], bytes[0]} : std::string(bytes, 2);
+}
+
+void append_u32(std::string& out, uint32_t value, bool le) {
+    append_u16(out, static_cast<uint16_t>(le ? value : value >> 16), le);
+    append_u16(out, static_cast<uint16_t>(le ? value >> 16 : value), le);
+}
+
+const std::string kThumbnailBytes = "\xFF\xD8thumb\xFF\xD9";
+
+// A TIFF block whose IFD1 points at kThumbnailBytes, stored right after it.
+// Non-zero overrides replace the offset and length written into IFD1.
+std::string make_tiff(bool le, uint32_t offset_override = 0, uint32_t length_override = 0) {
+    std::string tiff = le ? "II" : "MM";
+    append_u16(tiff, 42, le);
+    append_u32(tiff, 8, le);
+    append_u16(tiff, 0, le);   // IFD0: no entries
+    append_u32(tiff, 14, le);  // IFD1 offset
+    append_u16(tiff, 2, le);
+    const uint32_t offset = 14 + 2 + 2 * 12 + 4;
+    const uint16_t tags[2] = {0x0201, 0x0202};
+    const uint32_t values[2] = {
+        offset_override != 0 ? offset_override : offset,
+        length_override != 0 ? length_override : static_cast<uint32_t>(kThumbnailBytes.size())};
+    for (int i = 0; i < 2; ++i) {
+        append_u16(tiff, tags[i], le);
+        append_u16(tiff, 4, le);
+        append_u32(tiff, 1, le);
+        append_u32(tiff, values[i], le);
+    }
+    append_u32(tiff, 0, le);
+    return tiff + kThumbnailBytes;
+}
+
+std::string make_exif_jpeg(const std::string& tiff) {
+    std::string jpeg = "\xFF\xD8\xFF\xE1";
+    append_u16(jpeg, static_cast<uint16_t>(2 + 6 + tiff.size()), false);
+    jpeg += std::string("Exif\0\0", 6) + tiff;
+    return jpeg + "\xFF\xDA\x00\x02scan";
+}
+
+const uint8_t* bytes_of(const std::string& data) {
+    return reinterpret_cast<const uint8_t*>(data.data());
+}
+
+TEST(tiff_thumbnail_found_in_either_byte_order) {
+    for (const bool le : {false, true}) {
+        const std::string tiff = make_tiff(le);
+        size_t offset = 0;
+        size_t length = 0;
+        CHECK(find_tiff_thumbnail(bytes_of(tiff), tiff.size(), &offset, &length));
+        CHECK(tiff.substr(offset, length) == kThumbnailBytes);
+    }
+}
+
+TEST(tiff_thumbnail_rejects_out_of_range_entries) {
+    size_t offset = 0;
+    size_t length = 0;
+    std::string tiff = make_tiff(false, 0, 1000);
+    CHECK(!find_tiff_thumbnail(bytes_of(tiff), tiff.size(), &offset, &length));
+    tiff = make_tiff(false, 0xFFFFFFF0u, 0x20);
+    CHECK(!find_tiff_thumbnail(bytes_of(tiff), tiff.size(), &offset, &length));
+    tiff = make_tiff(true);
+    CHECK(!find_tiff_thumbnail(bytes_of(tiff), 20, &offset, &length));
+}
+
+TEST(exif_thumbnail_offset_is_relative_to_jpeg) {
+    const std::string jpeg = make_exif_jpeg(make_tiff(true));
+    size_t offset = 0;
+    size_t length = 0;
+    CHECK(find_exif_thumbnail(bytes_of(jpeg), jpeg.size(), &offset, &length));
+    CHECK(jpeg.substr(offset, length) == kThumbnailBytes);
+}
+
+TEST(exif_thumbnail_search_stops_at_scan) {
+    const std::string jpeg = std::string("\xFF\xD8\xFF\xDA\x00\x02", 6) + make_exif_jpeg(make_tiff(true));
+    size_t offset = 0;
+    size_t length = 0;
+    CHECK(!find_exif_thumbnail(bytes_of(jpeg), jpeg.size(), &offset, &length));
+    CHECK(!find_exif_thumbnail(bytes_of(jpeg), 3, &offset, &length));
+}
+
+std::string make_box(const char* type, const std::string& body) {
+    std::string box;
+    append_u32(box, static_cast<uint32_t>(8 + body.size()), false);
+    return box + std::string(type, 4) + body;
+}
+
+// Runs find_box over `movie` stored on the fake device.
+bool find_box_in(const std::string& movie, uint64_t begin, uint64_t end, const char* type, uint64_t* out_body, uint64_t* out_end) {
+    add_remote_file("/movie.mov", movie);
+    const int handle = open_fake_device();
+    if (handle == 0) {
+        return false;
+    }
+    bool found = false;
+    {
+        RemoteRangeReader reader(find_session(handle), "/movie.mov", movie.size());
+        found = find_box(reader, begin, end == 0 ? movie.size() : end, type, out_body, out_end);
+    }
+    iosb_close_device(handle);
+    return found;
+}
+
+TEST(find_box_finds_nested_box) {
+    const std::string movie = make_box("ftyp", "qt  ") + make_box("moov", make_box("mvhd", "12345678") + make_box("udta", "body"));
+    uint64_t body = 0;
+    uint64_t end = 0;
+    CHECK(find_box_in(movie, 0, 0, "moov", &body, &end));
+    CHECK(body == 20);
+    CHECK(end == movie.size());
+    CHECK(find_box_in(movie, body, end, "udta", &body, &end));
+    CHECK(movie.substr(static_cast<size_t>(body), static_cast<size_t>(end - body)) == "body");
+}
+
+TEST(find_box_rejects_truncated_box) {
+    std::string movie = make_box("ftyp", "qt  ");
+    append_u32(movie, 100, false);
+    movie += "moov" + std::string(20, '\0');
+    uint64_t body = 0;
+    uint64_t end = 0;
+    CHECK(!find_box_in(movie, 0, 0, "moov", &body, &end));
+}
+
+TEST(find_box_rejects_size_that_wraps) {
+    // A 64-bit size that would wrap pos + size back inside the file.
+    std::string movie = make_box("ftyp", "qt  ");
+    append_u32(movie, 1, false);
+    movie += "moov";
+    append_u32(movie, 0xFFFFFFFFu, false);
+    append_u32(movie, 0xFFFFFFF8u, false);
+    movie += std::string(16, '\0');
+    uint64_t body = 0;
+    uint64_t end = 0;
+    CHECK(!find_box_in(movie, 0, 0, "moov", &body, &end));
+}
+
+// Empties the cache directory so each test starts from a known total.
+void clear_cache_directory(const std::string& directory) {
+    CreateDirectoryA(directory.c_str(), nullptr);
+    WIN32_FIND_DATAA data = {};
+    HANDLE find = FindFirstFileA((directory + "\\*.jpg").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    do {
+        DeleteFileA((directory + "\\" + data.cFileName).c_str());
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+}
+
+// Cache paths use backslashes, so they are checked through the Win32 API.
+int64_t cached_file_size(const std::string& path) {
+    WIN32_FIND_DATAA data = {};
+    HANDLE find = FindFirstFileA(path.c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    FindClose(find);
+    return static_cast<int64_t>((static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow);
+}
+
+std::string commit_thumbnail(ThumbnailCache& cache, const std::string& key, size_t size) {
+    std::string path;
+    if (!cache.path_for(key, &path)) {
+        return std::string();
+    }
+    const std::string temp = local_path("thumb.tmp");
+    write_local(temp, pattern(size, static_cast<int>(key.size())));
+    if (!cache.commit(temp, path)) {
+        return std::string();
+    }
+    // Keeps write times distinct so eviction order is deterministic.
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    return path;
+}
+
+TEST(thumbnail_cache_rejects_zero_budget) {
+    const std::string directory = local_path("thumbs");
+    ThumbnailCache cache;
+    CHECK(!cache.configure(directory.c_str(), 0));
+    CHECK(last_error() == "Thumbnail cache size must be greater than zero");
+    std::string path;
+    CHECK(!cache.path_for("key", &path));
+}
+
+TEST(thumbnail_cache_evicts_least_recently_used) {
+    const std::string directory = local_path("thumbs");
+    clear_cache_directory(directory);
+    ThumbnailCache cache;
+    CHECK(cache.configure(directory.c_str(), 1000));
+    const std::string first = commit_thumbnail(cache, "first", 400);
+    const std::string second = commit_thumbnail(cache, "second", 400);
+    CHECK(!first.empty() && !second.empty());
+    CHECK(cache.lookup(first));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    const uint64_t evictions = g_metrics.thumb_evictions.load();
+    const std::string third = commit_thumbnail(cache, "third", 400);
+    CHECK(!third.empty());
+    CHECK(g_metrics.thumb_evictions.load() - evictions == 1);
+    CHECK(cached_file_size(first) == 400);
+    CHECK(cached_file_size(second) == -1);
+    CHECK(cached_file_size(third) == 400);
+}
+
+TEST(thumbnail_cache_keeps_entry_being_committed) {
+    const std::string directory = local_path("thumbs");
+    clear_cache_directory(directory);
+    ThumbnailCache cache;
+    CHECK(cache.configure(directory.c_str(), 1000));
+    const std::string small = commit_thumbnail(cache, "small", 500);
+    const std::string large = commit_thumbnail(cache, "large", 1200);
+    CHECK(!small.empty() && !large.empty());
+    CHECK(cached_file_size(small) == -1);
+    CHECK(cached_file_size(large) == 1200);
+}
+
+// --- Async engine ---
+
+TEST(async_pull_completes_through_poll) {
+    add_remote_file("/async.bin", pattern(100 * 1024, 10));
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+    int64_t op_id = 0;
+    CHECK(iosb_submit_pull(handle, "/async.bin", local_path("async.bin").c_str(), &op_id) == 1);
+    iosb_completion completion = {};
+    CHECK(iosb_poll_completions(&completion, 1, 5000) == 1);
+    CHECK(completion.op_id == op_id);
+    CHECK(completion.op_kind == IOSB_OP_PULL);
+    CHECK(completion.status == 1);
+    CHECK(read_local(local_path("async.bin")) == read_remote("/async.bin"));
+    CHECK(iosb_async_shutdown() == 1);
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+void ignore_completion(const iosb_completion*, void*) {}
+
+TEST(poll_fails_while_callback_is_set) {
+    CHECK(iosb_set_completion_callback(ignore_completion, nullptr) == 1);
+    iosb_completion completion = {};
+    CHECK(iosb_poll_completions(&completion, 1, 0) == -1);
+    CHECK(iosb_poll_completions(&completion, 1, -1) == -1);
+    CHECK(iosb_set_completion_callback(nullptr, nullptr) == 1);
+    CHECK(iosb_poll_completions(&completion, 1, 0) == 0);
+}
+
+TEST(waiting_poll_returns_on_shutdown_and_callback) {
+    CHECK(iosb_async_start(2) == 1);
+    std::atomic<int> polled{-2};
+    std::thread waiter([&] {
+        iosb_completion completion = {};
+        polled = iosb_poll_completions(&completion, 1, -1);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(iosb_async_shutdown() == 1);
+    waiter.join();
+    CHECK(polled == 0);
+
+    std::thread second([&] {
+        iosb_completion completion = {};
+        polled = iosb_poll_completions(&completion, 1, -1);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(iosb_set_completion_callback(ignore_completion, nullptr) == 1);
+    second.join();
+    CHECK(polled == 0);
+    CHECK(iosb_set_completion_callback(nullptr, nullptr) == 1);
+}
+
+TEST(submit_fails_while_shutdown_is_running) {
+    add_remote_file("/slow.bin", pattern(8 * kChunkSize, 11));
+    fake_afc_set_rtt_us(20000);
+    const int handle = open_fake_device();
+    CHECK(handle != 0);
+    int64_t op_id = 0;
+    CHECK(iosb_submit_pull(handle, "/slow.bin", local_path("slow.bin").c_str(), &op_id) == 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+
+    // The worker is mid-pull, so shutdown stays in the stopping state until
+    // the pull finishes.
+    std::atomic<int> shutdown_rc{-1};
+    std::thread stopper([&] { shutdown_rc = iosb_async_shutdown(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    CHECK(iosb_submit_stat(handle, "/slow.bin", &op_id) == 0);
+    CHECK(last_error() == "Async engine is shutting down.");
+    CHECK(iosb_async_start(2) == 0);
+    CHECK(iosb_async_shutdown() == 0);
+    stopper.join();
+    CHECK(shutdown_rc == 1);
+
+    iosb_completion completion = {};
+    CHECK(iosb_poll_completions(&completion, 1, 0) == 1);
+    CHECK(completion.status == 1);
+    fake_afc_set_rtt_us(0);
+    CHECK(iosb_submit_stat(handle, "/slow.bin", &op_id) == 1);
+    CHECK(iosb_poll_completions(&completion, 1, 5000) == 1);
+    CHECK(completion.entry.size_bytes == 8 * kChunkSize);
+    CHECK(iosb_async_shutdown() == 1);
+    CHECK(iosb_close_device(handle) == 1);
+}
+
+int main() {
+    prepare_output_dir();
+    int failed = 0;
+    for (const TestCase& test : test_cases()) {
+        fake_afc_reset();
+        g_test_failed = false;
+        test.run();
+        std::printf("%s %s\n", g_test_failed ? "FAIL" : "ok  ", test.name);
+        failed += g_test_failed ? 1 : 0;
+    }
+    std::printf("%d of %d tests failed\n", failed, static_cast<int>(test_cases().size()));
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,348 @@
+#define FAKE_AFC_EXPORTS
+#include "fake_afc.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Stand-in for libimobiledevice-1.0.dll. It exports the subset of the real
+// API the bridge binds, with the same signatures (handles are opaque
+// pointers), so the bridge loads it through its normal loader.
+
+namespace {
+
+constexpr const char* kFakeUdid = "FAKE-UDID";
+constexpr const char* kFakeMtime = "1700000000";
+constexpr int kAfcSuccess = 0;
+constexpr int kAfcObjectNotFound = 8;
+constexpr int kAfcInvalidArg = 7;
+constexpr uint64_t kAfcModeReadOnly = 1;
+
+struct OpenFile {
+    std::string path;
+    uint64_t position = 0;
+};
+
+struct FakeClient {
+    // A real AFC connection answers one request at a time.
+    std::mutex request_lock;
+};
+
+std::mutex g_mutex;
+std::map<std::string, std::string> g_files;
+std::map<std::string, std::vector<std::string>> g_directories;
+std::map<uint64_t, OpenFile> g_handles;
+uint64_t g_next_handle = 1;
+int g_fail_after = -1;
+int g_fail_rc = 0;
+int g_fail_count = 0;
+std::atomic<int> g_rtt_us{0};
+std::atomic<uint64_t> g_round_trips{0};
+std::atomic<int> g_clients_created{0};
+
+std::string parent_of(const std::string& path) {
+    const size_t slash = path.find_last_of('/');
+    return slash == 0 || slash == std::string::npos ? "/" : path.substr(0, slash);
+}
+
+std::string name_of(const std::string& path) {
+    return path.substr(path.find_last_of('/') + 1);
+}
+
+void link_into_parent(const std::string& path) {
+    if (path == "/") {
+        return;
+    }
+    auto& names = g_directories[parent_of(path)];
+    const std::string name = name_of(path);
+    if (std::find(names.begin(), names.end(), name) == names.end()) {
+        names.push_back(name);
+    }
+}
+
+char* duplicate(const std::string& text) {
+    char* copy = static_cast<char*>(std::malloc(text.size() + 1));
+    std::memcpy(copy, text.c_str(), text.size() + 1);
+    return copy;
+}
+
+char** make_list(const std::vector<std::string>& items) {
+    char** list = static_cast<char**>(std::calloc(items.size() + 1, sizeof(char*)));
+    for (size_t i = 0; i < items.size(); ++i) {
+        list[i] = duplicate(items[i]);
+    }
+    return list;
+}
+
+void free_list(char** list) {
+    if (list == nullptr) {
+        return;
+    }
+    for (size_t i = 0; list[i] != nullptr; ++i) {
+        std::free(list[i]);
+    }
+    std::free(list);
+}
+
+// Serializes the request on its client, waits one round trip and returns an
+// injected error code, or 0 when the request should be served.
+int round_trip(void* client) {
+    std::lock_guard<std::mutex> lock(static_cast<FakeClient*>(client)->request_lock);
+    g_round_trips.fetch_add(1);
+    const int rtt = g_rtt_us.load();
+    if (rtt > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(rtt));
+    }
+
+    std::lock_guard<std::mutex> state(g_mutex);
+    if (g_fail_after > 0) {
+        --g_fail_after;
+        return kAfcSuccess;
+    }
+    if (g_fail_after == 0 && g_fail_count > 0) {
+        --g_fail_count;
+        return g_fail_rc;
+    }
+    return kAfcSuccess;
+}
+
+}  // namespace
+
+extern "C" {
+
+FAKE_AFC_API int idevice_get_device_list(char*** devices, int* count) {
+    *devices = make_list({kFakeUdid});
+    *count = 1;
+    return 0;
+}
+
+FAKE_AFC_API int idevice_device_list_free(char** devices) {
+    free_list(devices);
+    return 0;
+}
+
+FAKE_AFC_API int idevice_new(void** device, const char* udid) {
+    if (udid != nullptr && std::strcmp(udid, kFakeUdid) != 0) {
+        *device = nullptr;
+        return -3;
+    }
+    *device = duplicate(kFakeUdid);
+    return 0;
+}
+
+FAKE_AFC_API int idevice_free(void* device) {
+    std::free(device);
+    return 0;
+}
+
+FAKE_AFC_API int lockdownd_client_new_with_handshake(void*, void** client, const char*) {
+    *client = duplicate("lockdownd");
+    return 0;
+}
+
+FAKE_AFC_API int lockdownd_client_free(void* client) {
+    std::free(client);
+    return 0;
+}
+
+FAKE_AFC_API int lockdownd_start_service(void*, const char*, void** service) {
+    *service = duplicate("afc");
+    return 0;
+}
+
+FAKE_AFC_API int lockdownd_service_descriptor_free(void* service) {
+    std::free(service);
+    return 0;
+}
+
+FAKE_AFC_API int afc_client_new(void*, void*, void** client) {
+    *client = new FakeClient();
+    g_clients_created.fetch_add(1);
+    return 0;
+}
+
+FAKE_AFC_API int afc_client_free(void* client) {
+    delete static_cast<FakeClient*>(client);
+    return 0;
+}
+
+FAKE_AFC_API int afc_read_directory(void* client, const char* path, char*** list) {
+    if (const int rc = round_trip(client)) {
+        return rc;
+    }
+    std::lock_guard<std::mutex> lock(g_mutex);
+    const auto it = g_directories.find(path);
+    if (it == g_directories.end()) {
+        return kAfcObjectNotFound;
+    }
+    std::vector<std::string> names{".", ".."};
+    names.insert(names.end(), it->second.begin(), it->second.end());
+    *list = make_list(names);
+    return 0;
+}
+
+FAKE_AFC_API int afc_dictionary_free(char** dictionary) {
+    free_list(dictionary);
+    return 0;
+}
+
+FAKE_AFC_API int afc_get_file_info(void* client, const char* path, char*** info) {
+    if (const int rc = round_trip(client)) {
+        return rc;
+    }
+    std::lock_guard<std::mutex> lock(g_mutex);
+    const bool is_directory = g_directories.count(path) != 0;
+    const auto file = g_files.find(path);
+    if (!is_directory && file == g_files.end()) {
+        return kAfcObjectNotFound;
+    }
+    const std::string size = is_directory ? "0" : std::to_string(file->second.size());
+    *info = make_list({"st_ifmt", is_directory ? "S_IFDIR" : "S_IFREG", "st_size", size, "st_mtime", kFakeMtime});
+    return 0;
+}
+
+FAKE_AFC_API int afc_file_open(void* client, const char* path, uint64_t mode, uint64_t* handle) {
+    if (const int rc = round_trip(client)) {
+        return rc;
+    }
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (mode == kAfcModeReadOnly) {
+        if (g_files.count(path) == 0) {
+            return kAfcObjectNotFound;
+        }
+    } else {
+        g_files[path].clear();
+        link_into_parent(path);
+    }
+    *handle = g_next_handle++;
+    g_handles[*handle] = OpenFile{path, 0};
+    return 0;
+}
+
+FAKE_AFC_API int afc_file_close(void* client, uint64_t handle) {
+    if (const int rc = round_trip(client)) {
+        return rc;
+    }
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return g_handles.erase(handle) != 0 ? 0 : kAfcInvalidArg;
+}
+
+FAKE_AFC_API int afc_file_read(void* client, uint64_t handle, char* data, uint32_t length, uint32_t* bytes_read) {
+    *bytes_read = 0;
+    if (const int rc = round_trip(client)) {
+        return rc;
+    }
+    std::lock_guard<std::mutex> lock(g_mutex);
+    const auto it = g_handles.find(handle);
+    if (it == g_handles.end()) {
+        return kAfcInvalidArg;
+    }
+    const std::string& content = g_files[it->second.path];
+    const uint64_t position = (std::min)(it->second.position, static_cast<uint64_t>(content.size()));
+    const uint32_t n = static_cast<uint32_t>((std::min)(static_cast<uint64_t>(length), content.size() - position));
+    if (n > 0) {
+        std::memcpy(data, content.data() + position, n);
+    }
+    it->second.position = position + n;
+    *bytes_read = n;
+    return 0;
+}
+
+FAKE_AFC_API int afc_file_write(void* client, uint64_t handle, const char* data, uint32_t length, uint32_t* bytes_written) {
+    *bytes_written = 0;
+    if (const int rc = round_trip(client)) {
+        return rc;
+    }
+    std::lock_guard<std::mutex> lock(g_mutex);
+    const auto it = g_handles.find(handle);
+    if (it == g_handles.end()) {
+        return kAfcInvalidArg;
+    }
+    g_files[it->second.path].append(data, length);
+    *bytes_written = length;
+    return 0;
+}
+
+FAKE_AFC_API int afc_file_seek(void* client, uint64_t handle, int64_t offset, int whence) {
+    if (const int rc = round_trip(client)) {
+        return rc;
+    }
+    std::lock_guard<std::mutex> lock(g_mutex);
+    const auto it = g_handles.find(handle);
+    if (it == g_handles.end() || whence != 0 || offset < 0) {
+        return kAfcInvalidArg;
+    }
+    it->second.position = static_cast<uint64_t>(offset);
+    return 0;
+}
+
+FAKE_AFC_API void fake_afc_reset(void) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_files.clear();
+    g_directories.clear();
+    g_directories["/"];
+    g_handles.clear();
+    g_fail_after = -1;
+    g_fail_count = 0;
+    g_rtt_us = 0;
+    g_round_trips = 0;
+    g_clients_created = 0;
+}
+
+FAKE_AFC_API void fake_afc_set_rtt_us(int rtt_us) {
+    g_rtt_us = rtt_us;
+}
+
+FAKE_AFC_API void fake_afc_add_directory(const char* path) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_directories[path];
+    link_into_parent(path);
+}
+
+FAKE_AFC_API void fake_afc_add_file(const char* path, const void* data, uint64_t size) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_files[path].assign(static_cast<const char*>(data), static_cast<size_t>(size));
+    link_into_parent(path);
+}
+
+FAKE_AFC_API int64_t fake_afc_read_file(const char* path, void* buffer, uint64_t buffer_size) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    const auto it = g_files.find(path);
+    if (it == g_files.end()) {
+        return -1;
+    }
+    const size_t n = static_cast<size_t>((std::min)(buffer_size, static_cast<uint64_t>(it->second.size())));
+    if (n > 0) {
+        std::memcpy(buffer, it->second.data(), n);
+    }
+    return static_cast<int64_t>(it->second.size());
+}
+
+FAKE_AFC_API void fake_afc_inject_failures(int after_requests, int rc, int count) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_fail_after = after_requests;
+    g_fail_rc = rc;
+    g_fail_count = count;
+}
+
+FAKE_AFC_API uint64_t fake_afc_round_trips(void) {
+    return g_round_trips.load();
+}
+
+FAKE_AFC_API int fake_afc_clients_created(void) {
+    return g_clients_created.load();
+}
+
+FAKE_AFC_API int fake_afc_open_handles(void) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return static_cast<int>(g_handles.size());
+}
+
+}  // extern "C"
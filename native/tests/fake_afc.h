@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef FAKE_AFC_EXPORTS
+#define FAKE_AFC_API __declspec(dllexport)
+#else
+#define FAKE_AFC_API __declspec(dllimport)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Control API of the fake libimobiledevice runtime used by the native tests
+   and benchmarks. The fake serves one device ("FAKE-UDID") from an in-memory
+   file system; every AFC request sleeps for the configured round-trip time
+   while holding its client's lock, as a real AFC connection serializes
+   requests. */
+
+/* Drops all files, directories, handles, counters and injected faults. */
+FAKE_AFC_API void fake_afc_reset(void);
+FAKE_AFC_API void fake_afc_set_rtt_us(int rtt_us);
+
+FAKE_AFC_API void fake_afc_add_directory(const char* path);
+FAKE_AFC_API void fake_afc_add_file(const char* path, const void* data, uint64_t size);
+/* Copies up to buffer_size bytes of a remote file. Returns the file size, or
+   -1 when it does not exist. */
+FAKE_AFC_API int64_t fake_afc_read_file(const char* path, void* buffer, uint64_t buffer_size);
+
+/* After `after_requests` more successful AFC requests, the next `count`
+   requests fail with `rc`. */
+FAKE_AFC_API void fake_afc_inject_failures(int after_requests, int rc, int count);
+
+FAKE_AFC_API uint64_t fake_afc_round_trips(void);
+FAKE_AFC_API int fake_afc_clients_created(void);
+FAKE_AFC_API int fake_afc_open_handles(void);
+
+#ifdef __cplusplus
+}
+#endif
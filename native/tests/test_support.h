@@ -0,0 +1,80 @@
+#pragma once
+
+// Helpers shared by bridge_tests.cpp and bridge_bench.cpp. Both include the
+// bridge source first, so the iosb_* API and its internals are in scope.
+
+#include "fake_afc.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace test_support {
+
+constexpr const char* kFakeUdid = "FAKE-UDID";
+constexpr const char* kOutputDir = "bridge_test_out";
+
+inline std::string local_path(const std::string& name) {
+    return std::string(kOutputDir) + "/" + name;
+}
+
+inline void prepare_output_dir() {
+    CreateDirectoryA(kOutputDir, nullptr);
+}
+
+inline bool local_exists(const std::string& path) {
+    return std::ifstream(path, std::ios::binary).good();
+}
+
+inline std::string read_local(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+inline void write_local(const std::string& path, const std::string& data) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+// Deterministic file content that differs per seed and per offset.
+inline std::string pattern(size_t size, int seed) {
+    std::string out(size, '\0');
+    for (size_t i = 0; i < size; ++i) {
+        out[i] = static_cast<char>((i * 31 + static_cast<size_t>(seed) * 7) & 0xff);
+    }
+    return out;
+}
+
+inline void add_remote_file(const std::string& path, const std::string& data) {
+    fake_afc_add_file(path.c_str(), data.data(), data.size());
+}
+
+inline std::string read_remote(const std::string& path) {
+    const int64_t size = fake_afc_read_file(path.c_str(), nullptr, 0);
+    if (size < 0) {
+        return std::string();
+    }
+    std::string out(static_cast<size_t>(size), '\0');
+    fake_afc_read_file(path.c_str(), &out[0], out.size());
+    return out;
+}
+
+inline std::string last_error() {
+    char buffer[IOSB_MAX_ERROR] = {};
+    iosb_get_last_error(buffer, sizeof(buffer));
+    return buffer;
+}
+
+// Returns the handle of the fake device, or 0 when it cannot be opened.
+inline int open_fake_device() {
+    int handle = 0;
+    return iosb_open_device(kFakeUdid, &handle) == 1 ? handle : 0;
+}
+
+inline double elapsed_ms(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+}  // namespace test_support
@@ -0,0 +1,72 @@
+using System.Runtime.InteropServices;
+
+namespace IOSBridgeExplorer.UI.Interop;
+
+/// <summary>
+/// Bridges native async completions to tasks. The native worker pool invokes a
+/// single registered callback; each submitted operation id maps to a pending task.
+/// </summary>
+internal static class NativeCompletions
+{
+    internal delegate int Submit(out long opId);
+
+    private static readonly object Sync = new();
+    private static readonly Dictionary<long, TaskCompletionSource<NativeMethods.CompletionNative>> Pending = new();
+    private static readonly Dictionary<long, NativeMethods.CompletionNative> Early = new();
+
+    // Kept in a static field so the delegate outlives every native call into it.
+    private static NativeMethods.CompletionCallback? _callback;
+
+    internal static Task<NativeMethods.CompletionNative> Run(Submit submit)
+    {
+        EnsureCallback();
+
+        var rc = submit(out var opId);
+        if (rc != 1)
+        {
+            throw new InvalidOperationException(NativeMethods.LastError());
+        }
+
+        lock (Sync)
+        {
+            // The operation may already have finished on a native worker.
+            if (Early.Remove(opId, out var completion))
+            {
+                return Task.FromResult(completion);
+            }
+
+            var tcs = new TaskCompletionSource<NativeMethods.CompletionNative>(TaskCreationOptions.RunContinuationsAsynchronously);
+            Pending.Add(opId, tcs);
+            return tcs.Task;
+        }
+    }
+
+    private static void EnsureCallback()
+    {
+        lock (Sync)
+        {
+            if (_callback is not null)
+            {
+                return;
+            }
+
+            _callback = OnCompletion;
+            NativeMethods.iosb_set_completion_callback(_callback, IntPtr.Zero);
+        }
+    }
+
+    private static void OnCompletion(IntPtr completionPtr, IntPtr userData)
+    {
+        var completion = Marshal.PtrToStructure<NativeMethods.CompletionNative>(completionPtr);
+        TaskCompletionSource<NativeMethods.CompletionNative>? tcs;
+        lock (Sync)
+        {
+            if (!Pending.Remove(completion.OpId, out tcs))
+            {
+                Early[completion.OpId] = completion;
+                return;
+            }
+        }
+        tcs.SetResult(completion);
+    }
+}
@@ -7,6 +7,10 @@ internal static class NativeMethods
 {
     private const string DllName = "ios_device_bridge.dll";
 
+    internal const int IoInteractive = 0;
+    internal const int IoBulk = 1;
+    internal const int IoPreview = 2;
+
     [StructLayout(LayoutKind.Sequential, CharSet = CharSet.Ansi)]
     internal struct DeviceInfoNative
     {
@@ -31,6 +35,38 @@ internal static class NativeMethods
         public long ModifiedUnix;
     }
 
+    [StructLayout(LayoutKind.Sequential, CharSet = CharSet.Ansi)]
+    internal struct CompletionNative
+    {
+        public long OpId;
+        public int OpKind;
+        public int Status;
+        public int ResultCount;
+        public FileEntryNative Entry;
+
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 512)]
+        public string LocalPath;
+
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 256)]
+        public string Error;
+    }
+
+    [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+    internal delegate void CompletionCallback(IntPtr completion, IntPtr userData);
+
+    [StructLayout(LayoutKind.Sequential, CharSet = CharSet.Ansi)]
+    internal struct PullItemNative
+    {
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 512)]
+        public string RemotePath;
+
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 512)]
+        public string LocalPath;
+
+        public ulong SizeBytes;
+        public int Result;
+    }
+
     [DllImport(DllName, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
     internal static extern int iosb_get_version(StringBuilder buffer, int bufferSize);
 
@@ -40,6 +76,9 @@ internal static class NativeMethods
     [DllImport(DllName, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
     internal static extern int iosb_get_runtime_diagnostics(StringBuilder buffer, int bufferSize);
 
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+    internal static extern int iosb_get_metrics(StringBuilder buffer, int bufferSize);
+
     [DllImport(DllName, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
     internal static extern int iosb_enumerate_devices([Out] DeviceInfoNative[]? outDevices, int maxDevices);
 
@@ -58,6 +97,39 @@ internal static class NativeMethods
     [DllImport(DllName, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
     internal static extern int iosb_push_file(int handle, string localPath, string remotePath);
 
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+    internal static extern int iosb_pull_files(int handle, [In, Out] PullItemNative[] items, int count);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    internal static extern int iosb_set_bandwidth_limit(int handle, int ioClass, ulong bytesPerSecond);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+    internal static extern int iosb_stat(int handle, string path, out FileEntryNative outEntry);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    internal static extern int iosb_set_completion_callback(CompletionCallback? callback, IntPtr userData);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+    internal static extern int iosb_submit_list_directory(int handle, string path, out long opId);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+    internal static extern int iosb_submit_stat(int handle, string path, out long opId);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+    internal static extern int iosb_submit_pull(int handle, string remotePath, string localPath, out long opId);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+    internal static extern int iosb_submit_push(int handle, string localPath, string remotePath, out long opId);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl)]
+    internal static extern int iosb_take_list_result(long opId, [Out] FileEntryNative[]? outEntries, int maxEntries);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+    internal static extern int iosb_set_thumbnail_cache(string directory, ulong maxBytes);
+
+    [DllImport(DllName, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+    internal static extern int iosb_submit_thumbnail(int handle, string remotePath, int maxEdge, out long opId);
+
     internal static string LastError()
     {
         var buffer = new StringBuilder(1024);
@@ -71,5 +143,12 @@ internal static class NativeMethods
         var ok = iosb_get_runtime_diagnostics(buffer, buffer.Capacity);
         return ok == 1 ? buffer.ToString() : LastError();
     }
+
+    internal static string Metrics()
+    {
+        var buffer = new StringBuilder(4096);
+        var ok = iosb_get_metrics(buffer, buffer.Capacity);
+        return ok == 1 ? buffer.ToString() : LastError();
+    }
 }
 
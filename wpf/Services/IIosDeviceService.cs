@@ -6,11 +6,19 @@ public interface IIosDeviceService : IDisposable
 {
     string GetVersion();
     string GetRuntimeDiagnostics();
+    string GetMetrics();
     IReadOnlyList<DeviceInfo> EnumerateDevices();
     void Connect(string udid);
     void Disconnect();
     IReadOnlyList<FileEntry> ListDirectory(string path);
+    Task<IReadOnlyList<FileEntry>> ListDirectoryAsync(string path);
+    Task<FileEntry> StatAsync(string path);
+    Task<string> GetThumbnailAsync(string remotePath, int maxEdge);
     void PullFile(string remotePath, string localPath);
     void PushFile(string localPath, string remotePath);
+    Task PullFileAsync(string remotePath, string localPath);
+    Task PushFileAsync(string localPath, string remotePath);
+    int PullFiles(IReadOnlyList<FileEntry> entries, string localDirectory);
+    void SetBulkBandwidthLimit(ulong bytesPerSecond);
 }
 
@@ -1,6 +1,7 @@
 using IOSBridgeExplorer.UI.Diagnostics;
 using IOSBridgeExplorer.UI.Interop;
 using IOSBridgeExplorer.UI.Models;
+using System.IO;
 using System.Text;
 
 namespace IOSBridgeExplorer.UI.Services;
@@ -9,7 +10,17 @@ public sealed class IosDeviceBridgeService : IIosDeviceService
 {
     private const long MinUnixSeconds = -62135596800L;
     private const long MaxUnixSeconds = 253402300799L;
-    private int _deviceHandle = -1;
+    private const ulong ThumbnailCacheBytes = 256UL * 1024 * 1024;
+    private static readonly string ThumbnailCacheDirectory = Path.Combine(
+        Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData),
+        "ios-bridge-explorer",
+        "thumbnails");
+    // Written by Connect and Disconnect, which the UI runs on a pool thread,
+    // and read from whichever thread issues a call. Writers swap it with
+    // Interlocked.Exchange so each handle is closed exactly once; readers
+    // take one snapshot through RequireHandle and use only that.
+    private volatile int _deviceHandle = -1;
+    private bool _thumbnailCacheConfigured;
 
     public string GetVersion()
     {
@@ -29,6 +40,11 @@ public sealed class IosDeviceBridgeService : IIosDeviceService
         return NativeMethods.RuntimeDiagnostics();
     }
 
+    public string GetMetrics()
+    {
+        return NativeMethods.Metrics();
+    }
+
     public IReadOnlyList<DeviceInfo> EnumerateDevices()
     {
         var count = NativeMethods.iosb_enumerate_devices(null, 0);
@@ -64,38 +80,39 @@ public sealed class IosDeviceBridgeService : IIosDeviceService
     public void Connect(string udid)
     {
         Disconnect();
-        var rc = NativeMethods.iosb_open_device(udid, out _deviceHandle);
+        var rc = NativeMethods.iosb_open_device(udid, out var handle);
         if (rc != 1)
         {
-            _deviceHandle = -1;
             var error = NativeMethods.LastError();
             AppLogger.Error($"iosb_open_device failed rc={rc} udid={udid}: {error}");
             throw new InvalidOperationException(error);
         }
-        AppLogger.Info($"iosb_open_device succeeded handle={_deviceHandle} udid={udid}");
+        var previous = Interlocked.Exchange(ref _deviceHandle, handle);
+        if (previous > 0)
+        {
+            NativeMethods.iosb_close_device(previous);
+        }
+        AppLogger.Info($"iosb_open_device succeeded handle={handle} udid={udid}");
     }
 
     public void Disconnect()
     {
-        if (_deviceHandle > 0)
+        var handle = Interlocked.Exchange(ref _deviceHandle, -1);
+        if (handle > 0)
         {
-            NativeMethods.iosb_close_device(_deviceHandle);
-            _deviceHandle = -1;
+            NativeMethods.iosb_close_device(handle);
         }
     }
 
     public IReadOnlyList<FileEntry> ListDirectory(string path)
     {
-        if (_deviceHandle <= 0)
-        {
-            throw new InvalidOperationException("No connected device.");
-        }
+        var handle = RequireHandle();
 
-        var count = NativeMethods.iosb_list_directory(_deviceHandle, path, null, 0);
+        var count = NativeMethods.iosb_list_directory(handle, path, null, 0);
         if (count < 0)
         {
             var error = NativeMethods.LastError();
-            AppLogger.Error($"iosb_list_directory(count) failed rc={count} handle={_deviceHandle} path={path}: {error}");
+            AppLogger.Error($"iosb_list_directory(count) failed rc={count} handle={handle} path={path}: {error}");
             throw new InvalidOperationException(error);
         }
         if (count == 0)
@@ -104,24 +121,101 @@ public sealed class IosDeviceBridgeService : IIosDeviceService
         }
 
         var buffer = new NativeMethods.FileEntryNative[count];
-        var written = NativeMethods.iosb_list_directory(_deviceHandle, path, buffer, buffer.Length);
+        var written = NativeMethods.iosb_list_directory(handle, path, buffer, buffer.Length);
         if (written < 0)
         {
             var error = NativeMethods.LastError();
-            AppLogger.Error($"iosb_list_directory(fill) failed rc={written} handle={_deviceHandle} path={path}: {error}");
+            AppLogger.Error($"iosb_list_directory(fill) failed rc={written} handle={handle} path={path}: {error}");
+            throw new InvalidOperationException(error);
+        }
+
+        return buffer.Take(written).Select(ToFileEntry).OrderByDescending(x => x.IsDirectory).ThenBy(x => x.Name).ToArray();
+    }
+
+    public async Task<IReadOnlyList<FileEntry>> ListDirectoryAsync(string path)
+    {
+        var handle = RequireHandle();
+        var completion = await NativeCompletions.Run((out long opId) => NativeMethods.iosb_submit_list_directory(handle, path, out opId));
+        if (completion.Status != 1)
+        {
+            AppLogger.Error($"iosb_submit_list_directory failed op={completion.OpId} handle={handle} path={path}: {completion.Error}");
+            throw new InvalidOperationException(completion.Error);
+        }
+
+        var buffer = new NativeMethods.FileEntryNative[completion.ResultCount];
+        var written = NativeMethods.iosb_take_list_result(completion.OpId, buffer, buffer.Length);
+        if (written < 0)
+        {
+            var error = NativeMethods.LastError();
+            AppLogger.Error($"iosb_take_list_result failed rc={written} op={completion.OpId} path={path}: {error}");
+            throw new InvalidOperationException(error);
+        }
+
+        return buffer.Take(written).Select(ToFileEntry).OrderByDescending(x => x.IsDirectory).ThenBy(x => x.Name).ToArray();
+    }
+
+    public async Task<FileEntry> StatAsync(string path)
+    {
+        var handle = RequireHandle();
+        var completion = await NativeCompletions.Run((out long opId) => NativeMethods.iosb_submit_stat(handle, path, out opId));
+        if (completion.Status != 1)
+        {
+            AppLogger.Error($"iosb_submit_stat failed op={completion.OpId} handle={handle} path={path}: {completion.Error}");
+            throw new InvalidOperationException(completion.Error);
+        }
+        return ToFileEntry(completion.Entry);
+    }
+
+    public async Task<string> GetThumbnailAsync(string remotePath, int maxEdge)
+    {
+        var handle = RequireHandle();
+        EnsureThumbnailCache();
+        var completion = await NativeCompletions.Run((out long opId) => NativeMethods.iosb_submit_thumbnail(handle, remotePath, maxEdge, out opId));
+        if (completion.Status != 1)
+        {
+            AppLogger.Error($"iosb_submit_thumbnail failed op={completion.OpId} handle={handle} remote={remotePath}: {completion.Error}");
+            throw new InvalidOperationException(completion.Error);
+        }
+        return completion.LocalPath;
+    }
+
+    private void EnsureThumbnailCache()
+    {
+        if (_thumbnailCacheConfigured)
+        {
+            return;
+        }
+
+        Directory.CreateDirectory(ThumbnailCacheDirectory);
+        var rc = NativeMethods.iosb_set_thumbnail_cache(ThumbnailCacheDirectory, ThumbnailCacheBytes);
+        if (rc != 1)
+        {
+            var error = NativeMethods.LastError();
+            AppLogger.Error($"iosb_set_thumbnail_cache failed rc={rc} dir={ThumbnailCacheDirectory}: {error}");
             throw new InvalidOperationException(error);
         }
+        _thumbnailCacheConfigured = true;
+    }
 
-        return buffer.Take(written).Select(x => new FileEntry
+    private int RequireHandle()
+    {
+        var handle = _deviceHandle;
+        if (handle <= 0)
         {
-            Path = x.Path,
-            Name = x.Name,
-            IsDirectory = x.IsDirectory == 1,
-            SizeBytes = x.SizeBytes,
-            ModifiedAt = SafeFromUnixTime(x.ModifiedUnix)
-        }).OrderByDescending(x => x.IsDirectory).ThenBy(x => x.Name).ToArray();
+            throw new InvalidOperationException("No connected device.");
+        }
+        return handle;
     }
 
+    private static FileEntry ToFileEntry(NativeMethods.FileEntryNative x) => new()
+    {
+        Path = x.Path,
+        Name = x.Name,
+        IsDirectory = x.IsDirectory == 1,
+        SizeBytes = x.SizeBytes,
+        ModifiedAt = SafeFromUnixTime(x.ModifiedUnix)
+    };
+
     private static DateTimeOffset SafeFromUnixTime(long raw)
     {
         var seconds = raw;
@@ -150,30 +244,88 @@ public sealed class IosDeviceBridgeService : IIosDeviceService
 
     public void PullFile(string remotePath, string localPath)
     {
-        if (_deviceHandle <= 0)
+        var handle = RequireHandle();
+        var rc = NativeMethods.iosb_pull_file(handle, remotePath, localPath);
+        if (rc != 1)
         {
-            throw new InvalidOperationException("No connected device.");
+            var error = NativeMethods.LastError();
+            AppLogger.Error($"iosb_pull_file failed rc={rc} handle={handle} remote={remotePath} local={localPath}: {error}");
+            throw new InvalidOperationException(error);
         }
-        var rc = NativeMethods.iosb_pull_file(_deviceHandle, remotePath, localPath);
+    }
+
+    public void PushFile(string localPath, string remotePath)
+    {
+        var handle = RequireHandle();
+        var rc = NativeMethods.iosb_push_file(handle, localPath, remotePath);
         if (rc != 1)
         {
             var error = NativeMethods.LastError();
-            AppLogger.Error($"iosb_pull_file failed rc={rc} handle={_deviceHandle} remote={remotePath} local={localPath}: {error}");
+            AppLogger.Error($"iosb_push_file failed rc={rc} handle={handle} local={localPath} remote={remotePath}: {error}");
             throw new InvalidOperationException(error);
         }
     }
 
-    public void PushFile(string localPath, string remotePath)
+    public async Task PullFileAsync(string remotePath, string localPath)
     {
-        if (_deviceHandle <= 0)
+        var handle = RequireHandle();
+        var completion = await NativeCompletions.Run((out long opId) => NativeMethods.iosb_submit_pull(handle, remotePath, localPath, out opId));
+        if (completion.Status != 1)
         {
-            throw new InvalidOperationException("No connected device.");
+            AppLogger.Error($"iosb_submit_pull failed op={completion.OpId} handle={handle} remote={remotePath} local={localPath}: {completion.Error}");
+            throw new InvalidOperationException(completion.Error);
         }
-        var rc = NativeMethods.iosb_push_file(_deviceHandle, localPath, remotePath);
+    }
+
+    public async Task PushFileAsync(string localPath, string remotePath)
+    {
+        var handle = RequireHandle();
+        var completion = await NativeCompletions.Run((out long opId) => NativeMethods.iosb_submit_push(handle, localPath, remotePath, out opId));
+        if (completion.Status != 1)
+        {
+            AppLogger.Error($"iosb_submit_push failed op={completion.OpId} handle={handle} local={localPath} remote={remotePath}: {completion.Error}");
+            throw new InvalidOperationException(completion.Error);
+        }
+    }
+
+    public int PullFiles(IReadOnlyList<FileEntry> entries, string localDirectory)
+    {
+        var handle = RequireHandle();
+
+        var items = entries.Where(x => !x.IsDirectory).Select(x => new NativeMethods.PullItemNative
+        {
+            RemotePath = x.Path,
+            LocalPath = Path.Combine(localDirectory, x.Name),
+            SizeBytes = x.SizeBytes
+        }).ToArray();
+        if (items.Length == 0)
+        {
+            return 0;
+        }
+
+        var rc = NativeMethods.iosb_pull_files(handle, items, items.Length);
+        if (rc < 0)
+        {
+            var error = NativeMethods.LastError();
+            AppLogger.Error($"iosb_pull_files failed rc={rc} handle={handle} count={items.Length}: {error}");
+            throw new InvalidOperationException(error);
+        }
+        if (rc != items.Length)
+        {
+            var error = NativeMethods.LastError();
+            AppLogger.Error($"iosb_pull_files partial rc={rc} handle={handle} count={items.Length}: {error}");
+        }
+        return rc;
+    }
+
+    public void SetBulkBandwidthLimit(ulong bytesPerSecond)
+    {
+        var handle = RequireHandle();
+        var rc = NativeMethods.iosb_set_bandwidth_limit(handle, NativeMethods.IoBulk, bytesPerSecond);
         if (rc != 1)
         {
             var error = NativeMethods.LastError();
-            AppLogger.Error($"iosb_push_file failed rc={rc} handle={_deviceHandle} local={localPath} remote={remotePath}: {error}");
+            AppLogger.Error($"iosb_set_bandwidth_limit failed rc={rc} handle={handle} bytesPerSecond={bytesPerSecond}: {error}");
             throw new InvalidOperationException(error);
         }
     }
@@ -16,6 +16,8 @@ public sealed class MainViewModel : ViewModelBase, IDisposable
     private FileEntry? _selectedEntry;
     private string _currentPath = "/";
     private string _statusText = "Ready";
+    private int _listingVersion;
+    private bool _connecting;
 
     public MainViewModel()
         : this(new IosDeviceBridgeService())
@@ -32,7 +34,7 @@ public sealed class MainViewModel : ViewModelBase, IDisposable
         ConnectCommand = new RelayCommand(ConnectDevice, () => SelectedDevice is not null);
         OpenCommand = new RelayCommand(OpenSelected, () => SelectedEntry?.IsDirectory == true);
         UpCommand = new RelayCommand(GoUp, () => CurrentPath != "/");
-        RefreshDirectoryCommand = new RelayCommand(RefreshDirectory, () => SelectedDevice is not null);
+        RefreshDirectoryCommand = new RelayCommand(async () => await RefreshDirectoryAsync(), () => SelectedDevice is not null);
 
         try
         {
@@ -144,19 +146,24 @@ public sealed class MainViewModel : ViewModelBase, IDisposable
         }
     }
 
-    private void ConnectDevice()
+    private async void ConnectDevice()
     {
-        if (SelectedDevice is null)
+        if (SelectedDevice is null || _connecting)
         {
             return;
         }
 
+        _connecting = true;
         try
         {
-            _service.Connect(SelectedDevice.Udid);
+            var device = SelectedDevice;
+            StatusText = $"Connecting: {device.Name}...";
+            // Opening a device (and closing the previous one) blocks on the
+            // device, so keep it off the dispatcher.
+            await Task.Run(() => _service.Connect(device.Udid));
             CurrentPath = "/";
-            RefreshDirectory();
-            StatusText = $"Connected: {SelectedDevice.Name}";
+            await RefreshDirectoryAsync();
+            StatusText = $"Connected: {device.Name}";
         }
         catch (Exception ex)
         {
@@ -164,9 +171,13 @@ public sealed class MainViewModel : ViewModelBase, IDisposable
             AppLogger.Error("ConnectDevice failed.", ex);
             MessageBox.Show(ex.Message, "Connection error", MessageBoxButton.OK, MessageBoxImage.Error);
         }
+        finally
+        {
+            _connecting = false;
+        }
     }
 
-    private void OpenSelected()
+    private async void OpenSelected()
     {
         if (SelectedEntry?.IsDirectory != true)
         {
@@ -174,10 +185,10 @@ public sealed class MainViewModel : ViewModelBase, IDisposable
         }
 
         CurrentPath = SelectedEntry.Path;
-        RefreshDirectory();
+        await RefreshDirectoryAsync();
     }
 
-    private void GoUp()
+    private async void GoUp()
     {
         if (CurrentPath == "/")
         {
@@ -187,24 +198,40 @@ public sealed class MainViewModel : ViewModelBase, IDisposable
         var trimmed = CurrentPath.TrimEnd('/');
         var index = trimmed.LastIndexOf('/');
         CurrentPath = index <= 0 ? "/" : trimmed[..index];
-        RefreshDirectory();
+        await RefreshDirectoryAsync();
     }
 
-    private void RefreshDirectory()
+    private async Task RefreshDirectoryAsync()
     {
+        // Listings run on the native worker pool; a newer navigation supersedes
+        // any listing still in flight.
+        var version = ++_listingVersion;
+        var path = CurrentPath;
         try
         {
             Entries.Clear();
-            foreach (var entry in _service.ListDirectory(CurrentPath))
+            StatusText = $"Path: {path} (loading...)";
+            var entries = await _service.ListDirectoryAsync(path);
+            if (version != _listingVersion)
+            {
+                return;
+            }
+
+            foreach (var entry in entries)
             {
                 Entries.Add(entry);
             }
-            StatusText = $"Path: {CurrentPath} ({Entries.Count} entries)";
+            StatusText = $"Path: {path} ({Entries.Count} entries)";
         }
         catch (Exception ex)
         {
+            if (version != _listingVersion)
+            {
+                return;
+            }
+
             StatusText = $"List failed: {ex.Message}";
-            AppLogger.Error($"RefreshDirectory failed. path={CurrentPath}", ex);
+            AppLogger.Error($"RefreshDirectory failed. path={path}", ex);
             MessageBox.Show(ex.Message, "Browse error", MessageBoxButton.OK, MessageBoxImage.Error);
         }
     }